@@ -0,0 +1,128 @@
+/*
+
+ Copyright (c) 2014 University of Edinburgh, Imperial College, University of Manchester.
+ Developed in the PAMELA project, EPSRC Programme Grant EP/K008730/1
+
+ This code is licensed under the MIT License.
+
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <sys/mman.h>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+////////////////////////// ARENA //////////////////////
+
+// One allocation carved into 64-byte aligned buffers, backed by huge pages where the system has them
+// or, when constructed without, by small pages only. Buffers are carved twice: a first pass with
+// nothing reserved only measures the arena, which reserve() then allocates for the second pass to hand out.
+class Arena {
+public:
+	static const size_t alignment = 64;
+	static const size_t huge_page = 2 << 20;
+
+	Arena(bool hugePages = true) : huge(hugePages), base(NULL), used(0), capacity(0), mapping(NULL),
+			mappingBytes(0), backing("none") {
+	}
+
+	~Arena() {
+		release();
+	}
+
+	void reserve() {
+		release();
+		capacity = (used + huge_page - 1) / huge_page * huge_page;
+#ifdef MAP_HUGETLB
+		if (huge) {
+			mapping = mmap(NULL, capacity, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (mapping != MAP_FAILED) {
+				mappingBytes = capacity;
+				base = (char *) mapping;
+				backing = "explicit huge pages";
+				return;
+			}
+		}
+#endif
+		// transparent huge pages need a range aligned on them
+		mappingBytes = capacity + huge_page;
+		mapping = mmap(NULL, mappingBytes, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (mapping == MAP_FAILED) {
+			std::cerr << "Error allocating an arena of " << capacity << " bytes" << std::endl;
+			exit(1);
+		}
+		base = (char *) (((size_t) mapping + huge_page - 1) / huge_page * huge_page);
+		backing = "small pages";
+#ifdef MADV_HUGEPAGE
+		if (huge && madvise(base, capacity, MADV_HUGEPAGE) == 0)
+			backing = "transparent huge pages";
+#endif
+#ifdef MADV_NOHUGEPAGE
+		if (!huge)
+			madvise(base, capacity, MADV_NOHUGEPAGE); // also where transparent huge pages are always on
+#endif
+	}
+
+	// start handing out buffers from the beginning again
+	void rewind() {
+		used = 0;
+		entries.clear();
+	}
+
+	// NULL until reserve()
+	void * carve(const char * name, size_t bytes) {
+		used = (used + alignment - 1) / alignment * alignment;
+		Entry entry = { name, used, bytes };
+		entries.push_back(entry);
+		used += bytes;
+		if (base == NULL)
+			return NULL;
+		if (used > capacity) {
+			std::cerr << "Arena overflow carving " << name << std::endl;
+			exit(1);
+		}
+		return base + entry.offset;
+	}
+
+	void print(std::ostream & out) const {
+		out << "arena: " << used << " bytes in " << capacity << " of " << backing
+				<< " at " << (void *) base << std::endl;
+		for (size_t i = 0; i < entries.size(); i++)
+			out << "arena: " << std::setw(10) << entries[i].offset << " "
+					<< std::setw(10) << entries[i].bytes << " " << entries[i].name << std::endl;
+	}
+
+	void release() {
+		if (mapping != NULL && mapping != MAP_FAILED)
+			munmap(mapping, mappingBytes);
+		mapping = NULL;
+		mappingBytes = 0;
+		base = NULL;
+		capacity = 0;
+	}
+
+private:
+	struct Entry {
+		std::string name;
+		size_t offset;
+		size_t bytes;
+	};
+
+	bool huge;
+	char * base;
+	size_t used;
+	size_t capacity;
+	void * mapping;
+	size_t mappingBytes;
+	const char * backing;
+	std::vector<Entry> entries;
+};
+
+#endif /* ARENA_H_ */
@@ -0,0 +1,219 @@
+/*
+
+ Copyright (c) 2014 University of Edinburgh, Imperial College, University of Manchester.
+ Developed in the PAMELA project, EPSRC Programme Grant EP/K008730/1
+
+ This code is licensed under the MIT License.
+
+ */
+
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <commons.h>
+#include <vector>
+#include <cstring>
+
+////////////////////////// CHECKPOINT //////////////////////
+
+// File layout: header, then for every brick holding an observed voxel its index, its byte count and
+// its TSDF and weight arrays run-length coded, voxels in logical x, y, z order within the brick.
+struct CheckpointHeader {
+	char magic[4];    // "KFCP"
+	uint version;
+	char format[8];   // voxel format name, arrays are stored raw
+	uint3 size;
+	float3 dim;
+	int3 origin;
+	Matrix4 pose;
+	uint frame;
+	uint bricks;
+};
+
+static const uint checkpoint_version = 1;
+
+// (count, value) pairs, runs of up to 255 equal values
+template<typename T>
+inline void rlePack(const T * in, uint n, std::vector<char> & out) {
+	for (uint i = 0; i < n;) {
+		uint run = 1;
+		while (i + run < n && run < 255 && in[i + run] == in[i])
+			run++;
+		out.push_back((char) run);
+		out.insert(out.end(), (const char *) &in[i], (const char *) &in[i] + sizeof(T));
+		i += run;
+	}
+}
+
+// decodes n values from [in, end), NULL if the pairs run past either
+template<typename T>
+inline const char * rleUnpack(const char * in, const char * end, T * out, uint n) {
+	for (uint i = 0; i < n;) {
+		if (end - in < (ptrdiff_t) (1 + sizeof(T)))
+			return NULL;
+		const uint run = (unsigned char) *in++;
+		if (run == 0 || run > n - i)
+			return NULL;
+		T value;
+		memcpy(&value, in, sizeof(T));
+		in += sizeof(T);
+		for (const uint last = i + run; i < last; i++)
+			out[i] = value;
+	}
+	return in;
+}
+
+// logical voxel range of a brick, clipped to the volume
+inline void brickRange(const uint3 size, const uint3 brick, uint3 & first, uint3 & last) {
+	first = make_uint3(brick.x * brick_size, brick.y * brick_size, brick.z * brick_size);
+	last = make_uint3(std::min(first.x + brick_size, size.x),
+			std::min(first.y + brick_size, size.y), std::min(first.z + brick_size, size.z));
+}
+
+template<typename F>
+void writeCheckpoint(const char * filename, const VolumeT<F> & vol, const Matrix4 & pose, uint frame) {
+	const uint3 bricks = vol.bricks();
+	const int count = bricks.x * bricks.y * bricks.z;
+	std::vector<std::vector<char> > packed(count);
+	int b;
+#pragma omp parallel for \
+        shared(packed), private(b) schedule(dynamic)
+	for (b = 0; b < count; b++) {
+		uint3 first, last;
+		brickRange(vol.size, make_uint3(b % bricks.x, (b / bricks.x) % bricks.y,
+				b / (bricks.x * bricks.y)), first, last);
+		typename F::tsdf_type tsdf[brick_size * brick_size * brick_size];
+		typename F::weight_type weight[brick_size * brick_size * brick_size];
+		uint n = 0;
+		bool observed = false;
+		for (uint z = first.z; z < last.z; z++)
+			for (uint y = first.y; y < last.y; y++)
+				for (uint x = first.x; x < last.x; x++, n++) {
+					const size_t i = vol.index(x, y, z);
+					tsdf[n] = vol.data[i];
+					weight[n] = vol.weight[i];
+					observed = observed || weight[n] != 0;
+				}
+		if (!observed)
+			continue;
+		rlePack(tsdf, n, packed[b]);
+		rlePack(weight, n, packed[b]);
+	}
+
+	CheckpointHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "KFCP", 4);
+	header.version = checkpoint_version;
+	strncpy(header.format, F::name(), sizeof(header.format));
+	header.size = vol.size;
+	header.dim = vol.dim;
+	header.origin = vol.origin;
+	header.pose = pose;
+	header.frame = frame;
+	for (b = 0; b < count; b++)
+		header.bricks += !packed[b].empty();
+
+	std::ofstream file(filename, std::ios::out | std::ios::binary);
+	if (file.fail()) {
+		std::cout << "Error opening file: " << filename << std::endl;
+		exit(1);
+	}
+	file.write((const char *) &header, sizeof(header));
+	for (b = 0; b < count; b++) {
+		if (packed[b].empty())
+			continue;
+		const uint record[2] = { (uint) b, (uint) packed[b].size() };
+		file.write((const char *) record, sizeof(record));
+		file.write(&packed[b][0], packed[b].size());
+	}
+	file.close();
+}
+
+// Restores a volume allocated with the checkpoint's resolution, returns the frame it was taken at
+template<typename F>
+uint readCheckpoint(const char * filename, VolumeT<F> & vol, Matrix4 & pose) {
+	std::ifstream file(filename, std::ios::in | std::ios::binary);
+	if (file.fail()) {
+		std::cout << "Error opening file: " << filename << std::endl;
+		exit(1);
+	}
+	CheckpointHeader header;
+	file.read((char *) &header, sizeof(header));
+	if (file.fail() || memcmp(header.magic, "KFCP", 4) != 0
+			|| header.version != checkpoint_version) {
+		std::cout << "Not a checkpoint: " << filename << std::endl;
+		exit(1);
+	}
+	if (strncmp(header.format, F::name(), sizeof(header.format)) != 0
+			|| header.size.x != vol.size.x || header.size.y != vol.size.y
+			|| header.size.z != vol.size.z) {
+		std::cout << "Checkpoint " << filename << " holds a " << header.size.x << "x"
+				<< header.size.y << "x" << header.size.z << " " << header.format
+				<< " volume, expected " << vol.size.x << "x" << vol.size.y << "x"
+				<< vol.size.z << " " << F::name() << std::endl;
+		exit(1);
+	}
+	std::vector<char> contents((std::istreambuf_iterator<char>(file)),
+			std::istreambuf_iterator<char>());
+	file.close();
+
+	const uint3 bricks = vol.bricks();
+	const int count = bricks.x * bricks.y * bricks.z;
+	std::vector<const char *> packed(count, (const char *) NULL);
+	std::vector<const char *> packedEnd(count, (const char *) NULL);
+	for (size_t offset = 0; offset + 2 * sizeof(uint) <= contents.size();) {
+		uint record[2];
+		memcpy(record, &contents[offset], sizeof(record));
+		offset += sizeof(record);
+		if (record[0] >= (uint) count || offset + record[1] > contents.size()) {
+			std::cout << "Corrupted checkpoint: " << filename << std::endl;
+			exit(1);
+		}
+		packed[record[0]] = &contents[offset];
+		offset += record[1];
+		packedEnd[record[0]] = &contents[0] + offset;
+	}
+
+	vol.dim = header.dim;
+	vol.origin = header.origin;
+	for (int axis = 0; axis < 3; axis++)
+		(&vol.shift.x)[axis] = (((&vol.origin.x)[axis] % (int) (&vol.size.x)[axis])
+				+ (&vol.size.x)[axis]) % (&vol.size.x)[axis];
+
+	// bricks missing from the checkpoint were never observed
+	const typename F::tsdf_type empty = F::encode(1.0f);
+	int b;
+#pragma omp parallel for \
+        shared(packed, packedEnd), private(b) schedule(dynamic)
+	for (b = 0; b < count; b++) {
+		uint3 first, last;
+		brickRange(vol.size, make_uint3(b % bricks.x, (b / bricks.x) % bricks.y,
+				b / (bricks.x * bricks.y)), first, last);
+		typename F::tsdf_type tsdf[brick_size * brick_size * brick_size];
+		typename F::weight_type weight[brick_size * brick_size * brick_size];
+		const uint n = (last.x - first.x) * (last.y - first.y) * (last.z - first.z);
+		if (packed[b]) {
+			const char * in = rleUnpack(packed[b], packedEnd[b], tsdf, n);
+			if (in == NULL || rleUnpack(in, packedEnd[b], weight, n) == NULL) {
+				std::cout << "Corrupted checkpoint: " << filename << std::endl;
+				exit(1);
+			}
+		} else {
+			std::fill(tsdf, tsdf + n, empty);
+			std::fill(weight, weight + n, 0);
+		}
+		uint k = 0;
+		for (uint z = first.z; z < last.z; z++)
+			for (uint y = first.y; y < last.y; y++)
+				for (uint x = first.x; x < last.x; x++, k++) {
+					const size_t i = vol.index(x, y, z);
+					vol.data[i] = tsdf[k];
+					vol.weight[i] = weight[k];
+				}
+	}
+
+	pose = header.pose;
+	return header.frame;
+}
+
+#endif /* CHECKPOINT_H_ */
@@ -21,6 +21,9 @@
 #include <limits.h>
 #endif
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <cstdio>
 #include <cstdlib>
 #include <fstream>
@@ -29,6 +32,7 @@
 #include <string>
 #include <cmath>
 #include <iterator>
+#include <algorithm>
 
 // Internal dependencies
 #include <default_parameters.h>
@@ -146,20 +150,172 @@ inline uchar4 gs2rgb(double h) {
 	return rgb;
 }
 
-struct Volume {
+// IEEE half precision conversions for the fp16 voxel format (round to nearest)
+inline unsigned short float_to_half(float f) {
+	union { float f; unsigned int u; } v;
+	v.f = f;
+	const unsigned int sign = (v.u >> 16) & 0x8000;
+	const int exp = (int) ((v.u >> 23) & 0xff) - 127 + 15;
+	unsigned int mant = v.u & 0x7fffff;
+	if (exp <= 0) { // subnormal or zero
+		if (exp < -10)
+			return sign;
+		mant |= 0x800000;
+		const int shift = 14 - exp;
+		unsigned int h = mant >> shift;
+		if ((mant >> (shift - 1)) & 1)
+			h++;
+		return sign | h;
+	}
+	if (exp >= 31) // TSDF values are within [-1, 1], saturate anything else
+		return sign | 0x7c00;
+	unsigned int h = sign | (exp << 10) | (mant >> 13);
+	if (mant & 0x1000)
+		h++; // a carry into the exponent is still the correctly rounded value
+	return h;
+}
+
+inline float half_to_float(unsigned short h) {
+	union { float f; unsigned int u; } v;
+	const unsigned int sign = (h & 0x8000) << 16;
+	const unsigned int exp = (h >> 10) & 0x1f;
+	const unsigned int mant = h & 0x3ff;
+	if (exp == 0) {
+		v.f = mant * (1.0f / 16777216.0f); // 2^-24
+		v.u |= sign;
+	} else if (exp == 31) {
+		v.u = sign | 0x7f800000 | (mant << 13);
+	} else {
+		v.u = sign | ((exp + 112) << 23) | (mant << 13);
+	}
+	return v.f;
+}
+
+// Voxel storage formats, chosen at compile time with -DKFUSION_VOXEL_FORMAT.
+// raw() is a stored TSDF value in multiples of unit(), so interp and grad scale once per sample.
+struct VoxelShort {
+	typedef short tsdf_type;
+	typedef short weight_type;
+	static const char * name() { return "short"; }
+	static tsdf_type encode(float d) { return d * 32766.0f; }
+	static float raw(tsdf_type t) { return t; }
+	static float unit() { return 0.00003051944088f; } //  1 / 32766.0f
+	static short toShort(tsdf_type t) { return t; }
+};
+
+struct VoxelInt8 {
+	typedef signed char tsdf_type;
+	typedef unsigned char weight_type;
+	static const char * name() { return "int8"; }
+	static tsdf_type encode(float d) { return floorf(d * 127.0f + 0.5f); }
+	static float raw(tsdf_type t) { return t; }
+	static float unit() { return 1.0f / 127.0f; }
+	static short toShort(tsdf_type t) { return t * 32766 / 127; }
+};
+
+struct VoxelHalf {
+	typedef unsigned short tsdf_type;
+	typedef unsigned char weight_type;
+	static const char * name() { return "half"; }
+	static tsdf_type encode(float d) { return float_to_half(d); }
+	static float raw(tsdf_type t) { return half_to_float(t); }
+	static float unit() { return 1.0f; }
+	static short toShort(tsdf_type t) { return half_to_float(t) * 32766.0f; }
+};
+
+#ifndef KFUSION_VOXEL_FORMAT
+#define KFUSION_VOXEL_FORMAT VoxelShort
+#endif
+
+// Edge of the cubic bricks of cells used to track and mesh the surface piecewise
+static const int brick_size = 8;
+
+template<typename F>
+struct VolumeT {
+	typedef F format;
+	typedef typename F::tsdf_type tsdf_type;
+	typedef typename F::weight_type weight_type;
+
 	uint3 size;
 	float3 dim;
-	short2 * data;
-
-	Volume() {
+	tsdf_type * data;     // TSDF, the only array read by raycast and rendering
+	weight_type * weight; // integration weights, touched by integrate only
+	int3 origin;          // world voxel of the logical voxel (0,0,0), moved by a rolling volume
+	uint3 shift;          // storage voxel of the logical voxel (0,0,0), i.e. origin modulo size
+	uint3 grid;           // bricks covering the volume, see bricks()
+	size_t mapped;        // bytes of the file mapping holding both arrays, 0 when allocated
+	bool owned;           // arrays allocated or mapped by init(), released by release()
+
+	VolumeT() {
 		size = make_uint3(0);
 		dim = make_float3(1);
 		data = NULL;
+		weight = NULL;
+		origin = make_int3(0);
+		shift = make_uint3(0);
+		grid = make_uint3(0);
+		mapped = 0;
+		owned = false;
+	}
+
+	// array offset of storage coordinates, x-major rows or, in a bricked build, brick by brick
+	// so that neighbouring voxels share cache lines and pages in every axis
+	inline size_t offset(const uint x, const uint y, const uint z) const {
+#ifdef KFUSION_BRICKED_VOLUME
+		return ((((size_t) (z / brick_size) * grid.y + y / brick_size) * grid.x + x / brick_size)
+				* brick_size * brick_size * brick_size)
+				+ ((z % brick_size) * brick_size + y % brick_size) * brick_size + x % brick_size;
+#else
+		return x + (size_t) y * size.x + (size_t) z * size.x * size.y;
+#endif
+	}
+
+	// elements in each array, whole bricks in a bricked build
+	static size_t voxels(const uint3 s) {
+#ifdef KFUSION_BRICKED_VOLUME
+		return (size_t) ((s.x + brick_size - 1) / brick_size) * ((s.y + brick_size - 1) / brick_size)
+				* ((s.z + brick_size - 1) / brick_size) * brick_size * brick_size * brick_size;
+#else
+		return (size_t) s.x * s.y * s.z;
+#endif
+	}
+
+	size_t voxels() const {
+		return voxels(size);
+	}
+
+	// storage index of a logical voxel, the storage wraps around in every axis
+	inline size_t index(const uint x, const uint y, const uint z) const {
+		const uint sx = x + shift.x;
+		const uint sy = y + shift.y;
+		const uint sz = z + shift.z;
+		return offset(sx < size.x ? sx : sx - size.x, sy < size.y ? sy : sy - size.y,
+				sz < size.z ? sz : sz - size.z);
+	}
+
+	// storage coordinates of a logical voxel, the identity until the volume has rolled
+	bool rolled() const {
+		return (shift.x | shift.y | shift.z) != 0;
+	}
+
+	template<bool rolled>
+	inline int3 wrap(const int3 p) const {
+		if (!rolled)
+			return p;
+		const int3 s = p + make_int3(shift);
+		return make_int3(s.x < (int) size.x ? s.x : s.x - size.x,
+				s.y < (int) size.y ? s.y : s.y - size.y,
+				s.z < (int) size.z ? s.z : s.z - size.z);
+	}
+
+	// world position of the logical voxel (0,0,0) corner
+	float3 corner() const {
+		return make_float3(origin) * dim / make_float3(size);
 	}
 
 	float2 operator[](const uint3 & pos) const {
-		const short2 d = data[pos.x + pos.y * size.x + pos.z * size.x * size.y];
-		return make_float2(d.x * 0.00003051944088f, d.y); //  / 32766.0f
+		const size_t i = index(pos.x, pos.y, pos.z);
+		return make_float2(F::raw(data[i]) * F::unit(), weight[i]);
 	}
 
 	float v(const uint3 & pos) const {
@@ -167,37 +323,46 @@ struct Volume {
 	}
 
 	float vs(const uint3 & pos) const {
-		return data[pos.x + pos.y * size.x + pos.z * size.x * size.y].x;
+		return F::raw(data[index(pos.x, pos.y, pos.z)]);
 	}
+	// storage coordinates, see wrap()
 	inline float vs2(const uint x, const uint y, const uint z) const {
-		return data[x + y * size.x + z * size.x * size.y].x;
+		return F::raw(data[offset(x, y, z)]);
 	}
 
 	void setints(const unsigned x, const unsigned y, const unsigned z,
 			const float2 &d) {
-		data[x + y * size.x + z * size.x * size.y] = make_short2(d.x * 32766.0f,
-				d.y);
+		const size_t i = index(x, y, z);
+		data[i] = F::encode(d.x);
+		weight[i] = d.y;
 	}
 
 	void set(const uint3 & pos, const float2 & d) {
-		data[pos.x + pos.y * size.x + pos.z * size.x * size.y] = make_short2(
-				d.x * 32766.0f, d.y);
+		const size_t i = index(pos.x, pos.y, pos.z);
+		data[i] = F::encode(d.x);
+		weight[i] = d.y;
 	}
 	float3 pos(const uint3 & p) const {
-		return make_float3((p.x + 0.5f) * dim.x / size.x,
-				(p.y + 0.5f) * dim.y / size.y, (p.z + 0.5f) * dim.z / size.z);
+		return make_float3((p.x + origin.x + 0.5f) * dim.x / size.x,
+				(p.y + origin.y + 0.5f) * dim.y / size.y,
+				(p.z + origin.z + 0.5f) * dim.z / size.z);
 	}
 
 	float interp(const float3 & pos) const {
+		return rolled() ? interp<true>(pos) : interp<false>(pos);
+	}
 
-		const float3 scaled_pos = make_float3((pos.x * size.x / dim.x) - 0.5f,
-				(pos.y * size.y / dim.y) - 0.5f,
-				(pos.z * size.z / dim.z) - 0.5f);
+	template<bool rolled>
+	float interp(const float3 & pos) const {
+
+		const float3 scaled_pos = make_float3((pos.x * size.x / dim.x) - 0.5f - origin.x,
+				(pos.y * size.y / dim.y) - 0.5f - origin.y,
+				(pos.z * size.z / dim.z) - 0.5f - origin.z);
 		const int3 base = make_int3(floorf(scaled_pos));
 		const float3 factor = fracf(scaled_pos);
-		const int3 lower = max(base, make_int3(0));
-		const int3 upper = min(base + make_int3(1),
-				make_int3(size) - make_int3(1));
+		const int3 lower = wrap<rolled>(max(base, make_int3(0)));
+		const int3 upper = wrap<rolled>(min(base + make_int3(1),
+				make_int3(size) - make_int3(1)));
 		return (((vs2(lower.x, lower.y, lower.z) * (1 - factor.x)
 				+ vs2(upper.x, lower.y, lower.z) * factor.x) * (1 - factor.y)
 				+ (vs2(lower.x, upper.y, lower.z) * (1 - factor.x)
@@ -208,22 +373,27 @@ struct Volume {
 						* (1 - factor.y)
 						+ (vs2(lower.x, upper.y, upper.z) * (1 - factor.x)
 								+ vs2(upper.x, upper.y, upper.z) * factor.x)
-								* factor.y) * factor.z) * 0.00003051944088f;
+								* factor.y) * factor.z) * F::unit();
+
+	}
 
+	float3 grad(const float3 & pos) const {
+		return rolled() ? grad<true>(pos) : grad<false>(pos);
 	}
 
+	template<bool rolled>
 	float3 grad(const float3 & pos) const {
-		const float3 scaled_pos = make_float3((pos.x * size.x / dim.x) - 0.5f,
-				(pos.y * size.y / dim.y) - 0.5f,
-				(pos.z * size.z / dim.z) - 0.5f);
+		const float3 scaled_pos = make_float3((pos.x * size.x / dim.x) - 0.5f - origin.x,
+				(pos.y * size.y / dim.y) - 0.5f - origin.y,
+				(pos.z * size.z / dim.z) - 0.5f - origin.z);
 		const int3 base = make_int3(floorf(scaled_pos));
 		const float3 factor = fracf(scaled_pos);
-		const int3 lower_lower = max(base - make_int3(1), make_int3(0));
-		const int3 lower_upper = max(base, make_int3(0));
-		const int3 upper_lower = min(base + make_int3(1),
-				make_int3(size) - make_int3(1));
-		const int3 upper_upper = min(base + make_int3(2),
-				make_int3(size) - make_int3(1));
+		const int3 lower_lower = wrap<rolled>(max(base - make_int3(1), make_int3(0)));
+		const int3 lower_upper = wrap<rolled>(max(base, make_int3(0)));
+		const int3 upper_lower = wrap<rolled>(min(base + make_int3(1),
+				make_int3(size) - make_int3(1)));
+		const int3 upper_upper = wrap<rolled>(min(base + make_int3(2),
+				make_int3(size) - make_int3(1)));
 		const int3 & lower = lower_upper;
 		const int3 & upper = upper_lower;
 
@@ -297,23 +467,82 @@ struct Volume {
 
 		return gradient
 				* make_float3(dim.x / size.x, dim.y / size.y, dim.z / size.z)
-				* (0.5f * 0.00003051944088f);
+				* (0.5f * F::unit());
 	}
 
-	void init(uint3 s, float3 d) {
+	// backing names a file to map both arrays from instead of allocating them, pages then move
+	// between memory and the file on demand so the volume can outgrow the RAM
+	void init(uint3 s, float3 d, const char * backing = NULL) {
 		size = s;
 		dim = d;
-		data = (short2 *) malloc(size.x * size.y * size.z * sizeof(short2));
-		assert(data != NULL);
+		origin = make_int3(0);
+		shift = make_uint3(0);
+		grid = bricks();
+		owned = true;
+		if (backing == NULL) {
+			mapped = 0;
+			data = (tsdf_type *) malloc(voxels() * sizeof(tsdf_type));
+			weight = (weight_type *) malloc(voxels() * sizeof(weight_type));
+			assert(data != NULL && weight != NULL);
+			return;
+		}
+		const size_t page = sysconf(_SC_PAGESIZE);
+		const size_t dataBytes = (voxels() * sizeof(tsdf_type) + page - 1) / page * page;
+		mapped = dataBytes + voxels() * sizeof(weight_type);
+		const int fd = open(backing, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0 || ftruncate(fd, mapped) != 0) {
+			std::cerr << "Error opening file: " << backing << std::endl;
+			exit(1);
+		}
+		char * base = (char *) mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (base == MAP_FAILED) {
+			std::cerr << "Error mapping file: " << backing << std::endl;
+			exit(1);
+		}
+		data = (tsdf_type *) base;
+		weight = (weight_type *) (base + dataBytes);
+	}
 
+	// arrays of voxels(s) elements provided by the caller, who keeps them
+	void init(uint3 s, float3 d, tsdf_type * tsdf, weight_type * weights) {
+		size = s;
+		dim = d;
+		origin = make_int3(0);
+		shift = make_uint3(0);
+		grid = bricks();
+		owned = false;
+		mapped = 0;
+		data = tsdf;
+		weight = weights;
+	}
+
+	size_t bytes() const {
+		return voxels() * (sizeof(tsdf_type) + sizeof(weight_type));
+	}
+
+	// bricks covering the volume, brick (x,y,z) holds the cells starting at voxel (x,y,z) * brick_size
+	uint3 bricks() const {
+		return make_uint3((size.x + brick_size - 1) / brick_size,
+				(size.y + brick_size - 1) / brick_size, (size.z + brick_size - 1) / brick_size);
 	}
 
 	void release() {
-		free(data);
+		if (owned && mapped) {
+			munmap(data, mapped);
+		} else if (owned) {
+			free(data);
+			free(weight);
+		}
+		owned = false;
+		mapped = 0;
 		data = NULL;
+		weight = NULL;
 	}
 };
 
+typedef VolumeT<KFUSION_VOXEL_FORMAT> Volume;
+
 typedef struct sMatrix4 {
 	float4 data[4];
 } Matrix4;
@@ -328,6 +557,34 @@ struct TrackData {
 	float J[6];
 };
 
+// Layouts of an image of points, see depth2vertexNormal
+
+// one padded float4 per point, a single aligned load each
+struct PaddedPoints {
+	float4 * p;
+	float3 get(uint i) const {
+		return make_float3(p[i]);
+	}
+	void set(uint i, const float3 v) const {
+		p[i] = make_float4(v.x, v.y, v.z, 0.0f);
+	}
+};
+
+// one plane per coordinate, the layout the CPU tracking path vectorises over
+struct PlanarPoints {
+	float * x;
+	float * y;
+	float * z;
+	float3 get(uint i) const {
+		return make_float3(x[i], y[i], z[i]);
+	}
+	void set(uint i, const float3 v) const {
+		x[i] = v.x;
+		y[i] = v.y;
+		z[i] = v.z;
+	}
+};
+
 inline __host__      __device__ float3 operator*(const Matrix4 & M,
 		const float3 & v) {
 	return make_float3(dot(make_float3(M.data[0]), v) + M.data[0].w,
@@ -395,7 +652,7 @@ TooN::Matrix<6> makeJTJ(const TooN::Vector<21, P, A> & v) {
 }
 
 template<typename T, typename A>
-TooN::Vector<6> solve(const TooN::Vector<27, T, A> & vals) {
+TooN::Vector<6> solveSVD(const TooN::Vector<27, T, A> & vals) {
 	const TooN::Vector<6> b = vals.template slice<0, 6>();
 	const TooN::Matrix<6> C = makeJTJ(vals.template slice<6, 21>());
 
@@ -403,6 +660,59 @@ TooN::Vector<6> solve(const TooN::Vector<27, T, A> & vals) {
 	return svd.backsub(b, 1e6);
 }
 
+// pivots smaller than this times the largest diagonal entry leave the system to the SVD
+static const double ldlt_min_pivot = 1e-6;
+
+// JTJ x = b by LDLT of the symmetric 6x6, false when it is too close to singular to trust
+template<typename T, typename A>
+bool solveLDLT(const TooN::Vector<27, T, A> & vals, TooN::Vector<6> & x) {
+	double C[6][6];
+	for (int r = 0, i = 6; r < 6; r++)
+		for (int c = r; c < 6; c++, i++)
+			C[r][c] = C[c][r] = vals[i];
+	double scale = 0;
+	for (int r = 0; r < 6; r++)
+		scale = std::max(scale, C[r][r]);
+
+	double L[6][6], D[6];
+	for (int j = 0; j < 6; j++) {
+		double d = C[j][j];
+		for (int k = 0; k < j; k++)
+			d -= L[j][k] * L[j][k] * D[k];
+		if (!(d > ldlt_min_pivot * scale))
+			return false;
+		D[j] = d;
+		for (int i = j + 1; i < 6; i++) {
+			double l = C[i][j];
+			for (int k = 0; k < j; k++)
+				l -= L[i][k] * L[j][k] * D[k];
+			L[i][j] = l / d;
+		}
+	}
+
+	double y[6];
+	for (int i = 0; i < 6; i++) {
+		y[i] = vals[i];
+		for (int k = 0; k < i; k++)
+			y[i] -= L[i][k] * y[k];
+	}
+	for (int i = 5; i >= 0; i--) {
+		double v = y[i] / D[i];
+		for (int k = i + 1; k < 6; k++)
+			v -= L[k][i] * x[k];
+		x[i] = v;
+	}
+	return true;
+}
+
+template<typename T, typename A>
+TooN::Vector<6> solve(const TooN::Vector<27, T, A> & vals) {
+	TooN::Vector<6> x;
+	if (solveLDLT(vals, x))
+		return x;
+	return solveSVD(vals);
+}
+
 template<typename P>
 inline Matrix4 toMatrix4(const TooN::SE3<P> & p) {
 	const TooN::Matrix<4, 4, float> I = TooN::Identity;
@@ -411,6 +721,103 @@ inline Matrix4 toMatrix4(const TooN::SE3<P> & p) {
 	return R;
 }
 
+// current extrapolated by the motion from previous to current, its twist scaled by damping
+inline Matrix4 predictPose(const Matrix4 & previous, const Matrix4 & current, float damping) {
+	const Matrix4 motion = current * inverse(previous);
+	if (damping == 1.0f)
+		return motion * current;
+	TooN::Matrix<3, 3, float> rotation;
+	TooN::Vector<3, float> translation;
+	for (int i = 0; i < 3; i++) {
+		rotation[i] = TooN::makeVector(motion.data[i].x, motion.data[i].y, motion.data[i].z);
+		translation[i] = motion.data[i].w;
+	}
+	const TooN::SE3<float> twist(TooN::SO3<float>(rotation), translation);
+	return toMatrix4(TooN::SE3<float>::exp(twist.ln() * damping)) * current;
+}
+
+// Voxel-driven TSDF update of columns of voxels, each voxel projected to the depth pixel it falls in
+template<typename F>
+struct ColumnIntegrator {
+	VolumeT<F> vol;
+	const float * depth;
+	uint2 depthSize;
+	Matrix4 invTrack;
+	Matrix4 K;
+	float mu;
+	float maxweight;
+	char * dirty;
+	uint3 bricks;
+	float3 delta;
+	float3 cameraDelta;
+
+	ColumnIntegrator(VolumeT<F> v, const float* d, uint2 dSize, const Matrix4 track,
+			const Matrix4 k, float m, float maxw, char * dirtyBricks) :
+			vol(v), depth(d), depthSize(dSize), invTrack(track), K(k), mu(m), maxweight(maxw),
+			dirty(dirtyBricks), bricks(v.bricks()) {
+		delta = rotate(invTrack, make_float3(0, 0, vol.dim.z / vol.size.z));
+		cameraDelta = rotate(K, delta);
+	}
+
+	// voxels [zBegin, zEnd) of column (x, y)
+	void operator()(uint x, uint y, uint zBegin, uint zEnd) {
+		uint3 pix = make_uint3(x, y, zBegin);
+		float3 pos = invTrack * vol.pos(pix);
+		float3 cameraX = K * pos;
+		int zFirst = vol.size.z, zLast = -1;
+
+		for (; pix.z < zEnd; ++pix.z, pos += delta, cameraX += cameraDelta) {
+			if (pos.z < 0.0001f) continue; // some near plane constraint
+			const float2 pixel = make_float2(cameraX.x / cameraX.z + 0.5f, cameraX.y / cameraX.z + 0.5f);
+
+			if (pixel.x < 0 || pixel.x > depthSize.x - 1 || pixel.y < 0 || pixel.y > depthSize.y - 1) continue;
+			const uint2 px = make_uint2(pixel.x, pixel.y);
+
+			if (depth[px.x + px.y * depthSize.x] == 0) continue;
+			const float diff = (depth[px.x + px.y * depthSize.x] - cameraX.z)
+							* std::sqrt(1 + sq(pos.x / pos.z) + sq(pos.y / pos.z));
+
+			if (diff > -mu) {
+				const float sdf = fminf(1.f, diff / mu);
+				float2 data = vol[pix];
+				data.x = clamp((data.y * data.x + sdf) / (data.y + 1), -1.f,
+						1.f);
+				data.y = fminf(data.y + 1, maxweight);
+				vol.set(pix, data);
+				zFirst = std::min(zFirst, (int) pix.z);
+				zLast = pix.z;
+			}
+		}
+
+		// a voxel changes the cells of the bricks it is a corner of, shared faces belong to two bricks
+		if (dirty != NULL && zLast >= 0) {
+			for (int by = (std::max((int) y, 1) - 1) / brick_size; by <= (int) y / brick_size; by++)
+				for (int bx = (std::max((int) x, 1) - 1) / brick_size; bx <= (int) x / brick_size; bx++)
+					for (int bz = (std::max(zFirst, 1) - 1) / brick_size; bz <= zLast / brick_size; bz++) {
+						// columns of the neighbouring threads mark the same bricks
+						const int b = bx + by * bricks.x + bz * bricks.x * bricks.y;
+#pragma omp atomic write
+						dirty[b] = 1;
+					}
+		}
+	}
+};
+
+// TSDF update of the volume rows [yBegin, yEnd), shared by the C++ integrateKernel and the host part of a split integration
+template<typename F>
+inline void integrateSlab(VolumeT<F> vol, const float* depth, uint2 depthSize,
+		const Matrix4 invTrack, const Matrix4 K, const float mu,
+		const float maxweight, int yBegin, int yEnd, char * dirty = NULL) {
+	ColumnIntegrator<F> column(vol, depth, depthSize, invTrack, K, mu, maxweight, dirty);
+	int y;
+#pragma omp parallel for \
+        shared(column), private(y)
+	for (y = yBegin; y < yEnd; y++)
+		for (unsigned int x = 0; x < vol.size.x; x++)
+			column(x, y, 0, vol.size.z);
+}
+
+
 static const float epsilon = 0.0000001;
 
 inline void compareTrackData(std::string str, TrackData* l, TrackData * r,
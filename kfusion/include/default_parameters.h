@@ -33,12 +33,32 @@ const int default_compute_size_ratio = 1;
 const int default_integration_rate = 2;
 const int default_rendering_rate = 4;
 const int default_tracking_rate = 1;
+const int default_checkpoint_rate = 0;
 const uint3 default_volume_resolution = make_uint3(256, 256, 256);
 const float3 default_volume_size = make_float3(2.f, 2.f, 2.f);
 const float3 default_initial_pos_factor = make_float3(0.5f, 0.5f, 0.0f);
 const bool default_no_gui = false;
 const bool default_render_volume_fullsize = false;
+const bool default_zero_copy = false;
+const float default_integration_split = 1.0f;
+const bool default_specialise_kernels = false;
+const bool default_live_mesh = false;
+const bool default_band_integration = false;
+const float default_rolling_threshold = 0.0f;
+const float default_motion_damping = -1.0f;
+const bool default_adaptive_icp = false;
+const bool default_reference_pyramid = false;
+const int default_raycast_ratio = 1;
+const std::string default_icp_sampling = "all";
+const int default_icp_samples = 4000;
 const std::string default_dump_volume_file = "";
+const std::string default_device_placement = "";
+const std::string default_ground_truth_file = "";
+const std::string default_evicted_file = "";
+const std::string default_mesh_file = "";
+const std::string default_checkpoint_file = "";
+const std::string default_volume_file = "";
+const std::string default_resume_file = "";
 const std::string default_input_file = "";
 const std::string default_log_file = "";
 const std::string default_log_file_cpu = "";
@@ -53,7 +73,7 @@ inline std::string pyramid2str(std::vector<int> v) {
 
 }
 
-static std::string short_options = "qc:d:f:i:l:m:k:o:p:r:s:t:v:y:z:a:e:g:";
+static std::string short_options = "qABLSYZC:I:T:E:F:G:M:P:R:U:V:W:X:c:d:f:i:l:m:k:o:p:r:s:t:v:y:z:a:e:g:";
 
 static struct option long_options[] =
   {
@@ -76,6 +96,25 @@ static struct option long_options[] =
 		    {"volume-resolution",      required_argument, 0, 'v'},
 		    {"pyramid-levels", 		   required_argument, 0, 'y'},
 		    {"rendering-rate", required_argument, 0, 'z'},
+		    {"zero-copy",  			   no_argument,       0, 'Z'},
+		    {"placement",  			   required_argument, 0, 'P'},
+		    {"integration-split",      required_argument, 0, 'X'},
+		    {"specialise",  		   no_argument,       0, 'S'},
+		    {"ground-truth",  		   required_argument, 0, 'G'},
+		    {"rolling-volume",  	   required_argument, 0, 'R'},
+		    {"evicted-file",  		   required_argument, 0, 'E'},
+		    {"mesh",  				   required_argument, 0, 'M'},
+		    {"live-mesh",  			   no_argument,       0, 'L'},
+		    {"band-integration",  	   no_argument,       0, 'B'},
+		    {"checkpoint",  		   required_argument, 0, 'C'},
+		    {"checkpoint-rate",  	   required_argument, 0, 'W'},
+		    {"resume",  			   required_argument, 0, 'U'},
+		    {"volume-file",  		   required_argument, 0, 'F'},
+		    {"motion-model",  		   required_argument, 0, 'V'},
+		    {"adaptive-icp",  		   no_argument,       0, 'A'},
+		    {"icp-sampling",  		   required_argument, 0, 'I'},
+		    {"reference-pyramid",  	   no_argument,       0, 'Y'},
+		    {"raycast-ratio",  		   required_argument, 0, 'T'},
 		    {0, 0, 0, 0}
 
 };
@@ -86,6 +125,7 @@ struct Configuration {
 
 	int compute_size_ratio;
 	int integration_rate;
+	int checkpoint_rate;
 	int rendering_rate;
 	int tracking_rate;
 	uint3 volume_resolution;
@@ -93,6 +133,13 @@ struct Configuration {
 	float3 initial_pos_factor;
 	std::vector<int> pyramid;
 	std::string dump_volume_file;
+	std::string device_placement;
+	std::string ground_truth_file;
+	std::string evicted_file;
+	std::string mesh_file;
+	std::string checkpoint_file;
+	std::string volume_file;
+	std::string resume_file;
 	std::string input_file;
 	std::string log_file;
 	std::string log_file_cpu;
@@ -110,6 +157,18 @@ struct Configuration {
 	float icp_threshold;
 	bool no_gui;
 	bool render_volume_fullsize;
+	bool zero_copy;
+	float integration_split;
+	bool specialise_kernels;
+	bool live_mesh;
+	bool band_integration;
+	float rolling_threshold;
+	float motion_damping;
+	bool adaptive_icp;
+	bool reference_pyramid;
+	int raycast_ratio;
+	std::string icp_sampling;
+	int icp_samples;
 	inline
 	void print_arguments() {
 		std ::cerr << "-c  (--compute-size-ratio)       : default is " << default_compute_size_ratio << "   (same size)      " << std::endl;
@@ -131,6 +190,30 @@ struct Configuration {
 		std ::cerr << "-v  (--volume-resolution)        : default is " << default_volume_resolution.x << "," << default_volume_resolution.y << "," << default_volume_resolution.z << "    " << std::endl;
 		std ::cerr << "-y  (--pyramid-levels)           : default is 10,5,4     " << std::endl;
 		std ::cerr << "-z  (--rendering-rate)   : default is " << default_rendering_rate << std::endl;
+		std ::cerr << "-Z  (--zero-copy)                : default is to copy input/render buffers (OpenCL only)" << std::endl;
+		std ::cerr << "-P  (--placement) <stage=devN,..> : default runs every stage on one device (OpenCL only)" << std::endl;
+		std ::cerr << "                                   stages are preprocess, track, integrate, raycast, render" << std::endl;
+		std ::cerr << "-X  (--integration-split)        : default is " << default_integration_split << " (device share of the volume rows, the rest on the CPU, OpenCL only)" << std::endl;
+		std ::cerr << "-S  (--specialise)               : default is generic kernels (OpenCL only, compares both)" << std::endl;
+		std ::cerr << "-G  (--ground-truth) <filename>  : report volume memory and ATE against a freiburg trajectory" << std::endl;
+		std ::cerr << "-R  (--rolling-volume)           : default is " << default_rolling_threshold << " (camera drift in metres before the volume follows it, 0 keeps it fixed)" << std::endl;
+		std ::cerr << "-E  (--evicted-file) <filename>  : slices leaving a rolling volume, default is to drop them" << std::endl;
+		std ::cerr << "-M  (--mesh) <filename>          : extract the surface at the end as a binary PLY mesh" << std::endl;
+		std ::cerr << "-L  (--live-mesh)                : default is no mesh while tracking (re-meshes touched bricks in the background)" << std::endl;
+		std ::cerr << "-B  (--band-integration)         : default sweeps the whole volume (integrate only the truncation band seen by the pixels)" << std::endl;
+		std ::cerr << "-C  (--checkpoint) <filename>    : save the volume, pose and frame at the end to resume from" << std::endl;
+		std ::cerr << "-W  (--checkpoint-rate)          : default is " << default_checkpoint_rate << " (also save the checkpoint every n frames, 0 only at the end)" << std::endl;
+		std ::cerr << "-U  (--resume) <filename>        : resume from a checkpoint, skipping the frames it already holds" << std::endl;
+		std ::cerr << "-F  (--volume-file) <filename>   : map the volume from this file instead of memory, logging page faults per frame" << std::endl;
+		std ::cerr << "-V  (--motion-model) <damping>   : default starts ICP from the previous pose without logging it; the last motion" << std::endl;
+		std ::cerr << "                                   scaled by damping (1 constant velocity, 0 none) predicts the start, ICP iterations are logged" << std::endl;
+		std ::cerr << "-A  (--adaptive-icp)             : default is fixed --pyramid-levels iterations; move them between levels by their" << std::endl;
+		std ::cerr << "                                   recent convergence within the same total, logging iterations and residuals" << std::endl;
+		std ::cerr << "-I  (--icp-sampling) <policy>[:n] : default is " << default_icp_sampling << "; stride, normal or gradient track levels with more" << std::endl;
+		std ::cerr << "                                   valid pixels than n (default " << default_icp_samples << ") on n of them, chosen once per frame" << std::endl;
+		std ::cerr << "-Y  (--reference-pyramid)        : default tracks every level against the full raycast (half sample it per level)" << std::endl;
+		std ::cerr << "-T  (--raycast-ratio)            : default is " << default_raycast_ratio << " (raycast the tracking reference at the computation size divided by" << std::endl;
+		std ::cerr << "                                   this power of two, at full size again after a frame fails to track)" << std::endl;
 	}
 	void print_values(std::ostream& out) {
 time_t rawtime;
@@ -245,6 +328,7 @@ time_t rawtime;
 
 		compute_size_ratio = default_compute_size_ratio;
 		integration_rate = default_integration_rate;
+		checkpoint_rate = default_checkpoint_rate;
 		tracking_rate = default_tracking_rate;
 		rendering_rate = default_rendering_rate;
 		volume_resolution = default_volume_resolution;
@@ -252,6 +336,13 @@ time_t rawtime;
 		initial_pos_factor = default_initial_pos_factor;
 
 		dump_volume_file = default_dump_volume_file;
+		device_placement = default_device_placement;
+		ground_truth_file = default_ground_truth_file;
+		evicted_file = default_evicted_file;
+		mesh_file = default_mesh_file;
+		checkpoint_file = default_checkpoint_file;
+		volume_file = default_volume_file;
+		resume_file = default_resume_file;
 		input_file = default_input_file;
 		log_file = default_log_file;
 		log_file_cpu = default_log_file_cpu;
@@ -264,6 +355,18 @@ time_t rawtime;
 		icp_threshold = default_icp_threshold;
 		no_gui = default_no_gui;
 		render_volume_fullsize = default_render_volume_fullsize;
+		zero_copy = default_zero_copy;
+		integration_split = default_integration_split;
+		specialise_kernels = default_specialise_kernels;
+		live_mesh = default_live_mesh;
+		band_integration = default_band_integration;
+		rolling_threshold = default_rolling_threshold;
+		motion_damping = default_motion_damping;
+		adaptive_icp = default_adaptive_icp;
+		reference_pyramid = default_reference_pyramid;
+		raycast_ratio = default_raycast_ratio;
+		icp_sampling = default_icp_sampling;
+		icp_samples = default_icp_samples;
 		camera_overrided = false;
 
 		this->pyramid.clear();
@@ -368,6 +471,114 @@ time_t rawtime;
 			case 'q':
 				this->no_gui = true;
 				break;
+			case 'Z':    //   -Z  (--zero-copy)
+				this->zero_copy = true;
+				std::cerr << "activate zero-copy buffers" << std::endl;
+				break;
+			case 'P':    //   -P  (--placement)
+				this->device_placement = optarg;
+				std::cerr << "update device placement to " << this->device_placement << std::endl;
+				break;
+			case 'G':    //   -G  (--ground-truth)
+				this->ground_truth_file = optarg;
+				std::cerr << "update ground_truth_file to " << this->ground_truth_file << std::endl;
+				break;
+			case 'R':    //   -R  (--rolling-volume)
+				this->rolling_threshold = atof(optarg);
+				std::cerr << "update rolling_threshold to " << this->rolling_threshold << std::endl;
+				if (this->rolling_threshold < 0) {
+					std::cerr << "ERROR: --rolling-volume (-R) must be positive (was " << optarg << ")\n";
+					flagErr++;
+				}
+				break;
+			case 'V':    //   -V  (--motion-model)
+				this->motion_damping = atof(optarg);
+				std::cerr << "update motion_damping to " << this->motion_damping << std::endl;
+				if (this->motion_damping < 0 || this->motion_damping > 1) {
+					std::cerr << "ERROR: --motion-model (-V) must be between 0 and 1 (was " << optarg << ")\n";
+					flagErr++;
+				}
+				break;
+			case 'E':    //   -E  (--evicted-file)
+				this->evicted_file = optarg;
+				std::cerr << "update evicted_file to " << this->evicted_file << std::endl;
+				break;
+			case 'B':    //   -B  (--band-integration)
+				this->band_integration = true;
+				std::cerr << "update band_integration to " << this->band_integration << std::endl;
+				break;
+			case 'I': {  //   -I  (--icp-sampling)
+				const std::string arg = optarg;
+				const size_t colon = arg.find(':');
+				this->icp_sampling = arg.substr(0, colon);
+				if (colon != std::string::npos)
+					this->icp_samples = atoi(arg.substr(colon + 1).c_str());
+				std::cerr << "update icp_sampling to " << this->icp_sampling << " with "
+						<< this->icp_samples << " samples" << std::endl;
+				if ((this->icp_sampling != "all" && this->icp_sampling != "stride"
+						&& this->icp_sampling != "normal" && this->icp_sampling != "gradient")
+						|| this->icp_samples <= 0) {
+					std::cerr << "ERROR: --icp-sampling (-I) must be all, stride, normal or gradient, with a positive count (was " << optarg << ")\n";
+					flagErr++;
+				}
+				break;
+			}
+			case 'T':    //   -T  (--raycast-ratio)
+				this->raycast_ratio = atoi(optarg);
+				std::cerr << "update raycast_ratio to " << this->raycast_ratio << std::endl;
+				if (this->raycast_ratio <= 0 || (this->raycast_ratio & (this->raycast_ratio - 1)) != 0) {
+					std::cerr << "ERROR: --raycast-ratio (-T) must be a power of two (was " << optarg << ")\n";
+					flagErr++;
+				}
+				break;
+			case 'Y':    //   -Y  (--reference-pyramid)
+				this->reference_pyramid = true;
+				std::cerr << "update reference_pyramid to " << this->reference_pyramid << std::endl;
+				break;
+			case 'A':    //   -A  (--adaptive-icp)
+				this->adaptive_icp = true;
+				std::cerr << "update adaptive_icp to " << this->adaptive_icp << std::endl;
+				break;
+			case 'L':    //   -L  (--live-mesh)
+				this->live_mesh = true;
+				std::cerr << "update live_mesh to " << this->live_mesh << std::endl;
+				break;
+			case 'C':    //   -C  (--checkpoint)
+				this->checkpoint_file = optarg;
+				std::cerr << "update checkpoint_file to " << this->checkpoint_file << std::endl;
+				break;
+			case 'W':    //   -W  (--checkpoint-rate)
+				this->checkpoint_rate = atoi(optarg);
+				std::cerr << "update checkpoint_rate to " << this->checkpoint_rate << std::endl;
+				if (this->checkpoint_rate < 0) {
+					std::cerr << "ERROR: --checkpoint-rate (-W) must >= 0 (was " << optarg << ")\n";
+					flagErr++;
+				}
+				break;
+			case 'F':    //   -F  (--volume-file)
+				this->volume_file = optarg;
+				std::cerr << "update volume_file to " << this->volume_file << std::endl;
+				break;
+			case 'U':    //   -U  (--resume)
+				this->resume_file = optarg;
+				std::cerr << "update resume_file to " << this->resume_file << std::endl;
+				break;
+			case 'M':    //   -M  (--mesh)
+				this->mesh_file = optarg;
+				std::cerr << "update mesh_file to " << this->mesh_file << std::endl;
+				break;
+			case 'S':    //   -S  (--specialise)
+				this->specialise_kernels = true;
+				std::cerr << "activate specialised kernels" << std::endl;
+				break;
+			case 'X':    //   -X  (--integration-split)
+				this->integration_split = atof(optarg);
+				std::cerr << "update integration_split to " << this->integration_split << std::endl;
+				if ((this->integration_split < 0) || (this->integration_split > 1)) {
+					std::cerr << "ERROR: --integration-split (-X) must be within [0, 1] (was " << optarg << ")\n";
+					flagErr++;
+				}
+				break;
 			case 'r':    //   -r  (--integration-rate)
 				this->integration_rate = atoi(optarg);
 				std::cerr << "update integration_rate to "
@@ -0,0 +1,105 @@
+/*
+
+ Copyright (c) 2014 University of Edinburgh, Imperial College, University of Manchester.
+ Developed in the PAMELA project, EPSRC Programme Grant EP/K008730/1
+
+ This code is licensed under the MIT License.
+
+ */
+
+#ifndef ICP_BUDGET_H_
+#define ICP_BUDGET_H_
+
+#include <commons.h>
+#include <vector>
+
+////////////////////////// ICP BUDGET //////////////////////
+
+static const float icp_improvement = 0.01f;   // relative residual drop that makes an iteration useful
+static const float icp_smoothing = 0.2f;      // weight of the last frame in the useful iteration average
+
+// Iterations allowed at each pyramid level and what the ICP made of them on the last frame.
+// Adapting moves iterations towards the levels whose residual was still dropping when they
+// stopped, away from the ones that stall, never spending more than the configured total.
+class IcpBudget {
+public:
+	void init(const std::vector<int> & iterations) {
+		caps = iterations;
+		budget = iterations;
+		average.assign(iterations.size(), 0.0f);
+		for (size_t level = 0; level < caps.size(); level++)
+			average[level] = caps[level] - 1;
+		used.assign(caps.size(), 0);
+		useful.assign(caps.size(), 0);
+		converged.assign(caps.size(), false);
+		residual.assign(caps.size(), 0.0f);
+		inliers.assign(caps.size(), 0.0f);
+	}
+
+	void begin() {
+		std::fill(used.begin(), used.end(), 0);
+		std::fill(useful.begin(), useful.end(), 0);
+		std::fill(converged.begin(), converged.end(), false);
+		std::fill(residual.begin(), residual.end(), 0.0f);
+		std::fill(inliers.begin(), inliers.end(), 0.0f);
+	}
+
+	// output is the reduction of the iteration, measuring the pose it started from
+	void record(int level, const float * output, bool done) {
+		const float count = output[28];
+		const float error = (count > 0) ? std::sqrt(output[0] / count) : 0.0f;
+		if (used[level] > 0 && error < (1.0f - icp_improvement) * residual[level])
+			useful[level] = used[level];
+		used[level]++;
+		residual[level] = error;
+		inliers[level] = count;
+		converged[level] = done;
+		// the update of the last iteration is never measured, unless it converged
+		if (done || (used[level] == budget[level] && useful[level] == used[level] - 1))
+			useful[level] = used[level];
+	}
+
+	// budget of the next frame from the useful iterations of the recent ones, plus one to probe
+	void adapt() {
+		int total = 0, spent = 0;
+		for (size_t level = 0; level < caps.size(); level++) {
+			average[level] += icp_smoothing * (useful[level] - average[level]);
+			budget[level] = std::min(std::max((int) std::ceil(average[level]) + 1, 1),
+					2 * caps[level]);
+			total += caps[level];
+			spent += budget[level];
+		}
+		// over the total, take from the level furthest above its configured share
+		while (spent > total) {
+			int richest = -1;
+			for (size_t level = 0; level < caps.size(); level++)
+				if (budget[level] > 1 && (richest < 0 || budget[level] * caps[richest]
+						> budget[richest] * caps[level]))
+					richest = level;
+			if (richest < 0)
+				break;
+			budget[richest]--;
+			spent--;
+		}
+	}
+
+	// coarsest level first: budget, iterations, converged, residual, inliers
+	void print(std::ostream & out, uint frame, bool tracked) const {
+		out << "icp\t" << frame;
+		for (int level = caps.size() - 1; level >= 0; level--)
+			out << "\t" << budget[level] << "\t" << used[level] << "\t" << converged[level]
+					<< "\t" << residual[level] << "\t" << (int) inliers[level];
+		out << "\t" << tracked << std::endl;
+	}
+
+	std::vector<int> caps;
+	std::vector<int> budget;
+	std::vector<float> average;
+	std::vector<int> used;
+	std::vector<int> useful;
+	std::vector<bool> converged;
+	std::vector<float> residual;
+	std::vector<float> inliers;
+};
+
+#endif /* ICP_BUDGET_H_ */
@@ -19,29 +19,50 @@ void initVolumeKernel(Volume volume);
 
 void bilateralFilterKernel(float* out, const float* in, uint2 inSize, const float * gaussian, float e_d, int r);
 
-void depth2vertexKernel(float3* vertex, const float * depth, uint2 imageSize, const Matrix4 invK);
-
 void reduceKernel(float * out, TrackData* J, const uint2 Jsize, const uint2 size);
 
-void trackKernel(TrackData* output, const float3* inVertex,
-		const float3* inNormal, uint2 inSize, const float3* refVertex,
-		const float3* refNormal, uint2 refSize, const Matrix4 Ttrack,
+void trackKernel(TrackData* output, const PlanarPoints inVertex,
+		const PlanarPoints inNormal, uint2 inSize, const PlanarPoints refVertex,
+		const PlanarPoints refNormal, uint2 refSize, const Matrix4 Ttrack,
 		const Matrix4 view, const float dist_threshold,
 		const float normal_threshold);
 
-void vertex2normalKernel(float3 * out, const float3 * in, uint2 imageSize);
+enum IcpSampling {
+	ICP_SAMPLING_ALL, ICP_SAMPLING_STRIDE, ICP_SAMPLING_NORMAL, ICP_SAMPLING_GRADIENT
+};
+
+uint selectSamplesKernel(uint* samples, uint & validCount, const PlanarPoints normal,
+		const float* depth, uint2 size, IcpSampling policy, uint target);
+
+void trackSamplesKernel(TrackData* output, const uint* samples, uint count,
+		const PlanarPoints inVertex, const PlanarPoints inNormal,
+		const PlanarPoints refVertex, const PlanarPoints refNormal, uint2 refSize,
+		const Matrix4 Ttrack, const Matrix4 view, const float dist_threshold,
+		const float normal_threshold);
+
+void scatterSamplesKernel(TrackData* output, const TrackData* sampled, const uint* samples,
+		uint count, uint2 inSize, uint2 outSize);
+
+void depth2vertexNormalKernel(PlanarPoints vertex, PlanarPoints normal, const float * depth,
+		uint2 imageSize, const Matrix4 invK);
 
 void mm2metersKernel(float * out, uint2 outSize, const ushort * in, uint2 inSize);
 
 void halfSampleRobustImageKernel(float* out, const float* in, uint2 imageSize, const float e_d, const int r);
 
+void halfSamplePointsKernel(PlanarPoints outVertex, PlanarPoints outNormal,
+		const PlanarPoints inVertex, const PlanarPoints inNormal, uint2 inSize, const float e_d);
+
+void preprocessKernel(float * depth, float ** pyramid, uint levels, uint2 size,
+		const ushort * in, uint2 inSize, const float * gaussian, float e_d);
+
 bool updatePoseKernel(Matrix4 & pose, const float * output, float icp_threshold);
 
 bool checkPoseKernel(Matrix4 & pose, Matrix4 oldPose, const float * output, uint2 imageSize, float track_threshold);
 
-void integrateKernel(Volume vol, const float* depth, uint2 imageSize, const Matrix4 invTrack, const Matrix4 K, const float mu, const float maxweight);
+void integrateKernel(Volume vol, const float* depth, uint2 imageSize, const Matrix4 invTrack, const Matrix4 K, const float mu, const float maxweight, char * dirtyBricks = NULL);
 
-void raycastKernel(float3* vertex, float3* normal, uint2 inputSize,
+void raycastKernel(PlanarPoints vertex, PlanarPoints normal, uint2 inputSize,
 		const Volume integration, const Matrix4 view, const float nearPlane,
 		const float farPlane, const float step, const float largestep);
 
@@ -68,6 +89,54 @@ void init();
 
 void clean();
 
+////////////////////////// BACKEND OPTIONS //////////////////////
+
+// Wrap the caller's input/render buffers as host-visible device memory instead of copying them
+void setZeroCopy(bool enable);
+
+// Place pipeline stages on devices, e.g. "track=dev0,integrate=dev1"; unlisted stages keep the default device
+void setDevicePlacement(const std::string & placement);
+
+// Share of the volume rows integrated on the device, the rest runs on the host CPU; the split then adapts every frame
+void setIntegrationSplit(float deviceShare);
+
+// Also build kernels with the run configuration (including mu) baked in, and time them against the generic ones
+void setSpecialisedKernels(bool enable, float mu);
+
+// Keep the volume around the camera, shifting it by whole voxels once the camera drifts further than
+// threshold (metres, 0 disables) from its starting place; evicted slices go to evictedFile if given
+void setRollingVolume(float threshold, const std::string & evictedFile);
+
+// Keep a mesh of the surface up to date on a background thread, re-meshing only the bricks integration touched
+void setLiveMesh(bool enable);
+
+// Map the volume from this file instead of allocating it, paging it in and out on demand; page faults are logged per frame
+void setVolumeFile(const std::string & filename);
+
+// Integrate pixel by pixel, only within the truncation band around the surface instead of sweeping the whole volume
+void setBandIntegration(bool enable);
+
+// Start ICP from the pose extrapolated by the last frame's motion times damping, logging iterations per level; negative disables both
+void setMotionModel(float damping);
+
+// Move ICP iterations from levels that stall to levels still converging when they stop, keeping the total;
+// logs iterations, residual and inliers per level like the motion model
+void setAdaptiveIcp(bool enable);
+
+// Raycast the tracking reference at the computation size divided by ratio, a power of two up to the
+// coarsest pyramid level; a frame that fails to track is followed by a full resolution raycast
+void setRaycastRatio(uint ratio);
+
+// Half sample the raycast once per frame into a reference per pyramid level, each level tracking
+// against the one of its own size rather than the full resolution raycast
+void setReferencePyramid(bool enable);
+
+// Track levels with more valid pixels than samples on that many of them, chosen once per frame by
+// policy "stride", "normal" or "gradient"; "all" tracks every pixel
+void setIcpSampling(const std::string & policy, uint samples);
+
+struct BrickMesh;
+
 /// OBJ ///
 
 class Kfusion {
@@ -168,6 +237,13 @@ public:
 	bool integration(float4 k, uint integration_rate, float mu, uint frame);
 
 	void dumpVolume(const char* filename);
+	void dumpMesh(const char* filename);
+	// Sparse checkpoint of the observed bricks with the pose and the frame to resume at
+	void saveCheckpoint(const char* filename, uint frame);
+	uint loadCheckpoint(const char* filename);
+	// Live mesh bricks changed after version since (all with 0), optionally waiting for the pending ones;
+	// returns the version to ask from next time
+	uint meshDelta(uint since, std::vector<uint> & bricks, std::vector<BrickMesh> & meshes, bool wait = false);
 	void renderVolume(uchar4 * out, const uint2 outputSize, int frame, int rate, float4 k, float mu);
 	void renderTrack(uchar4 * out, const uint2 outputSize);
 	void renderDepth(uchar4* out, uint2 outputSize);
@@ -0,0 +1,510 @@
+/*
+
+ Copyright (c) 2014 University of Edinburgh, Imperial College, University of Manchester.
+ Developed in the PAMELA project, EPSRC Programme Grant EP/K008730/1
+
+ This code is licensed under the MIT License.
+
+ */
+
+#ifndef MARCHING_CUBES_H_
+#define MARCHING_CUBES_H_
+
+#include <commons.h>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+////////////////////////// MARCHING CUBES //////////////////////
+
+// Cube corners and edges, edges go from their lower to their upper corner along one axis
+static const int mc_corner[8][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 },
+		{ 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 } };
+static const int mc_edge[12][2] = { { 0, 1 }, { 1, 2 }, { 3, 2 }, { 0, 3 }, { 4, 5 }, { 5, 6 },
+		{ 7, 6 }, { 4, 7 }, { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 } };
+static const int mc_edge_axis[12] = { 0, 1, 0, 1, 0, 1, 0, 1, 2, 2, 2, 2 };
+// faces as corner cycles, counter-clockwise seen from outside the cube
+static const int mc_face[6][4] = { { 0, 3, 2, 1 }, { 4, 5, 6, 7 }, { 0, 1, 5, 4 },
+		{ 3, 7, 6, 2 }, { 0, 4, 7, 3 }, { 1, 2, 6, 5 } };
+
+// Triangles (cube edge triples, -1 terminated) of the 256 inside/outside corner configurations.
+// Built from the faces: on each face the crossings are joined around the inside corners, so two
+// cells sharing a face always agree and the extracted surface is closed.
+struct MarchingCubesTable {
+	signed char triangles[256][16];
+
+	MarchingCubesTable() {
+		for (int config = 0; config < 256; config++) {
+			int next[12];
+			for (int e = 0; e < 12; e++)
+				next[e] = -1;
+			for (int f = 0; f < 6; f++) {
+				int crossing[4];
+				bool entering[4];
+				int count = 0;
+				for (int i = 0; i < 4; i++) {
+					const int a = mc_face[f][i];
+					const int b = mc_face[f][(i + 1) % 4];
+					if (inside(config, a) == inside(config, b))
+						continue;
+					crossing[count] = edge(a, b);
+					entering[count] = inside(config, b);
+					count++;
+				}
+				// link each crossing into the inside run to the crossing leaving it
+				for (int i = 0; i < count; i++)
+					if (entering[i])
+						next[crossing[i]] = crossing[(i + 1) % count];
+			}
+			int n = 0;
+			bool done[12] = { false };
+			for (int e = 0; e < 12; e++) {
+				if (next[e] < 0 || done[e])
+					continue;
+				int loop[12];
+				int length = 0;
+				for (int l = e; !done[l]; l = next[l]) {
+					done[l] = true;
+					loop[length++] = l;
+				}
+				for (int i = 1; i + 1 < length; i++) {
+					triangles[config][n++] = loop[0];
+					triangles[config][n++] = loop[i];
+					triangles[config][n++] = loop[i + 1];
+				}
+			}
+			for (; n < 16; n++)
+				triangles[config][n] = -1;
+		}
+	}
+
+	static bool inside(int config, int corner) {
+		return (config >> corner) & 1;
+	}
+
+	static int edge(int a, int b) {
+		for (int e = 0; e < 12; e++)
+			if ((mc_edge[e][0] == a && mc_edge[e][1] == b)
+					|| (mc_edge[e][0] == b && mc_edge[e][1] == a))
+				return e;
+		return -1;
+	}
+};
+
+inline const MarchingCubesTable & marchingCubesTable() {
+	static const MarchingCubesTable table;
+	return table;
+}
+
+// Vertex on the edge from logical voxel p along axis, when both ends are observed and the TSDF changes sign
+template<typename F>
+inline int mcEdgeVertex(const VolumeT<F> & vol, const uint3 p, int axis,
+		std::vector<float3> & vertices) {
+	uint3 q = p;
+	(&q.x)[axis]++;
+	const float2 a = vol[p];
+	const float2 b = vol[q];
+	if (a.y == 0 || b.y == 0 || ((a.x < 0) == (b.x < 0)))
+		return -1;
+	const float t = a.x / (a.x - b.x);
+	vertices.push_back(vol.pos(p) + (vol.pos(q) - vol.pos(p)) * t);
+	return vertices.size() - 1;
+}
+
+// Per slab of cells: its own vertices, the first boundary ones lying on its lower plane,
+// and triangle corners as own vertex indices, or -(i + 2) for vertex i of the next slab (-1 is no vertex)
+struct MarchingCubesSlab {
+	std::vector<float3> vertices;
+	std::vector<int> boundaryKeys; // (x + y * size.x) * 2 + axis, ascending
+	std::vector<int> refs;
+};
+
+template<typename F>
+void marchingCubes(const VolumeT<F> & vol, std::vector<float3> & vertices,
+		std::vector<uint3> & triangles) {
+	const MarchingCubesTable & table = marchingCubesTable();
+	const uint3 cells = vol.size - make_uint3(1);
+	const int3 bricks = make_int3((cells.x + brick_size - 1) / brick_size,
+			(cells.y + brick_size - 1) / brick_size, (cells.z + brick_size - 1) / brick_size);
+	const uint plane = vol.size.x * vol.size.y;
+
+	// bricks holding both signs among observed voxels, including the shared faces with the next bricks
+	std::vector<char> active(bricks.x * bricks.y * bricks.z);
+	int bz;
+#pragma omp parallel for \
+        shared(active), private(bz) schedule(dynamic)
+	for (bz = 0; bz < bricks.z; bz++)
+		for (int by = 0; by < bricks.y; by++)
+			for (int bx = 0; bx < bricks.x; bx++) {
+				bool negative = false, positive = false;
+				uint3 p;
+				for (p.z = (uint) (bz * brick_size); p.z <= std::min((uint) ((bz + 1) * brick_size), cells.z); p.z++)
+					for (p.y = (uint) (by * brick_size); p.y <= std::min((uint) ((by + 1) * brick_size), cells.y); p.y++)
+						for (p.x = (uint) (bx * brick_size); p.x <= std::min((uint) ((bx + 1) * brick_size), cells.x); p.x++) {
+							const float2 d = vol[p];
+							if (d.y == 0)
+								continue;
+							negative = negative || (d.x < 0);
+							positive = positive || (d.x >= 0);
+						}
+				active[bx + by * bricks.x + bz * bricks.x * bricks.y] = negative && positive;
+			}
+
+	// owner brick of the edges leaving voxel (px, py) of brick layer layer
+#define MC_ACTIVE(px, py, layer) active[std::min((int) (px) / brick_size, bricks.x - 1) \
+		+ std::min((int) (py) / brick_size, bricks.y - 1) * bricks.x + (layer) * bricks.x * bricks.y]
+
+	// one slab per brick layer; the vertices of its lower plane come first so the previous slab can share them
+	std::vector<MarchingCubesSlab> slabs(bricks.z);
+	int s;
+#pragma omp parallel for \
+        shared(slabs), private(s) schedule(dynamic)
+	for (s = 0; s < bricks.z; s++) {
+		uint3 p = make_uint3(0, 0, s * brick_size);
+		for (p.y = 0; p.y < vol.size.y; p.y++)
+			for (p.x = 0; p.x < vol.size.x; p.x++) {
+				if (!MC_ACTIVE(p.x, p.y, s))
+					continue;
+				for (int axis = 0; axis < 2; axis++)
+					if ((&p.x)[axis] < (&cells.x)[axis]
+							&& mcEdgeVertex(vol, p, axis, slabs[s].vertices) >= 0)
+						slabs[s].boundaryKeys.push_back((p.x + p.y * vol.size.x) * 2 + axis);
+			}
+	}
+
+#pragma omp parallel for \
+        shared(slabs), private(s) schedule(dynamic)
+	for (s = 0; s < bricks.z; s++) {
+		MarchingCubesSlab & slab = slabs[s];
+		const uint zEnd = std::min((uint) (s + 1) * brick_size, cells.z);
+		// x/y edge vertices of the lower and upper planes, z edge vertices in between
+		std::vector<int> lower(2 * plane, -1), upper(2 * plane), between(plane);
+		for (uint i = 0; i < slab.boundaryKeys.size(); i++)
+			lower[slab.boundaryKeys[i]] = i;
+
+		for (uint z = s * brick_size; z < zEnd; z++) {
+			uint3 p;
+			std::fill(between.begin(), between.end(), -1);
+			std::fill(upper.begin(), upper.end(), -1);
+			for (p.y = 0; p.y < vol.size.y; p.y++)
+				for (p.x = 0; p.x < vol.size.x; p.x++) {
+					if (!MC_ACTIVE(p.x, p.y, s))
+						continue;
+					p.z = z;
+					between[p.x + p.y * vol.size.x] = mcEdgeVertex(vol, p, 2, slab.vertices);
+				}
+			if (z + 1 == zEnd && s + 1 < bricks.z) {
+				const std::vector<int> & keys = slabs[s + 1].boundaryKeys;
+				for (uint i = 0; i < keys.size(); i++)
+					upper[keys[i]] = -(int) (i + 2);
+			} else {
+				for (p.y = 0; p.y < vol.size.y; p.y++)
+					for (p.x = 0; p.x < vol.size.x; p.x++) {
+						if (!MC_ACTIVE(p.x, p.y, s))
+							continue;
+						p.z = z + 1;
+						for (int axis = 0; axis < 2; axis++)
+							if ((&p.x)[axis] < (&cells.x)[axis])
+								upper[(p.x + p.y * vol.size.x) * 2 + axis] =
+										mcEdgeVertex(vol, p, axis, slab.vertices);
+					}
+			}
+
+			for (p.y = 0; p.y < cells.y; p.y++)
+				for (p.x = 0; p.x < cells.x; p.x++) {
+					if (!MC_ACTIVE(p.x, p.y, s))
+						continue;
+					int config = 0;
+					bool observed = true;
+					for (int c = 0; c < 8 && observed; c++) {
+						const float2 d = vol[make_uint3(p.x + mc_corner[c][0],
+								p.y + mc_corner[c][1], z + mc_corner[c][2])];
+						observed = d.y > 0;
+						if (d.x < 0)
+							config |= 1 << c;
+					}
+					if (!observed || config == 0 || config == 255)
+						continue;
+					const signed char * tri = table.triangles[config];
+					for (int t = 0; tri[t] >= 0; t += 3) {
+						int ref[3];
+						for (int k = 0; k < 3; k++) {
+							const int e = tri[t + k];
+							const int * corner = mc_corner[mc_edge[e][0]];
+							const uint i = (p.x + corner[0]) + (p.y + corner[1]) * vol.size.x;
+							const int axis = mc_edge_axis[e];
+							ref[k] = (axis == 2) ? between[i] :
+									(corner[2] ? upper : lower)[i * 2 + axis];
+						}
+						if (ref[0] == -1 || ref[1] == -1 || ref[2] == -1)
+							continue;
+						slab.refs.insert(slab.refs.end(), ref, ref + 3);
+					}
+				}
+			lower.swap(upper);
+		}
+	}
+#undef MC_ACTIVE
+
+	std::vector<uint> offset(bricks.z + 1, 0);
+	for (s = 0; s < bricks.z; s++)
+		offset[s + 1] = offset[s] + slabs[s].vertices.size();
+	vertices.resize(offset[bricks.z]);
+	uint triangleCount = 0;
+	for (s = 0; s < bricks.z; s++)
+		triangleCount += slabs[s].refs.size() / 3;
+	triangles.resize(triangleCount);
+	triangleCount = 0;
+	for (s = 0; s < bricks.z; s++) {
+		std::copy(slabs[s].vertices.begin(), slabs[s].vertices.end(),
+				vertices.begin() + offset[s]);
+		const std::vector<int> & refs = slabs[s].refs;
+		for (uint i = 0; i < refs.size(); i++)
+			(&triangles[triangleCount + i / 3].x)[i % 3] = (refs[i] >= 0) ?
+					offset[s] + refs[i] : offset[s + 1] - refs[i] - 2;
+		triangleCount += refs.size() / 3;
+	}
+}
+
+////////////////////////// INCREMENTAL MESHING //////////////////////
+
+// Surface of one brick of cells, its vertices are not shared with the neighbouring bricks
+struct BrickMesh {
+	std::vector<float3> vertices;
+	std::vector<uint3> triangles;
+};
+
+// Copy of the voxels read by one brick of cells, unobserved beyond the volume
+struct VoxelBrick {
+	static const int side = brick_size + 1;
+
+	uint id;
+	float3 corner;    // world position of its first voxel
+	float3 voxelSize;
+	float2 voxels[side * side * side];
+
+	template<typename F>
+	void copy(const VolumeT<F> & vol, const uint3 brick, uint i) {
+		id = i;
+		const uint3 first = make_uint3(brick.x * brick_size, brick.y * brick_size, brick.z * brick_size);
+		corner = vol.pos(first);
+		voxelSize = vol.dim / make_float3(vol.size);
+		float2 * v = voxels;
+		for (int z = 0; z < side; z++)
+			for (int y = 0; y < side; y++)
+				for (int x = 0; x < side; x++, v++) {
+					const uint3 p = first + make_uint3(x, y, z);
+					*v = (p.x < vol.size.x && p.y < vol.size.y && p.z < vol.size.z) ?
+							vol[p] : make_float2(1, 0);
+				}
+	}
+};
+
+inline void marchingCubesBrick(const VoxelBrick & brick, BrickMesh & mesh) {
+	const MarchingCubesTable & table = marchingCubesTable();
+	const int side = VoxelBrick::side;
+	const int step[3] = { 1, side, side * side };
+	int edges[side * side * side * 3]; // vertex of the edge leaving each voxel along each axis
+	std::fill(edges, edges + side * side * side * 3, -1);
+	mesh.vertices.clear();
+	mesh.triangles.clear();
+
+	for (int z = 0; z < brick_size; z++)
+		for (int y = 0; y < brick_size; y++)
+			for (int x = 0; x < brick_size; x++) {
+				const int cell = x + y * side + z * side * side;
+				int config = 0;
+				bool observed = true;
+				for (int c = 0; c < 8 && observed; c++) {
+					const float2 d = brick.voxels[cell + mc_corner[c][0] * step[0]
+							+ mc_corner[c][1] * step[1] + mc_corner[c][2] * step[2]];
+					observed = d.y > 0;
+					if (d.x < 0)
+						config |= 1 << c;
+				}
+				if (!observed || config == 0 || config == 255)
+					continue;
+				const signed char * tri = table.triangles[config];
+				for (int t = 0; tri[t] >= 0; t += 3) {
+					uint3 triangle;
+					for (int k = 0; k < 3; k++) {
+						const int * corner = mc_corner[mc_edge[tri[t + k]][0]];
+						const int axis = mc_edge_axis[tri[t + k]];
+						const int v = cell + corner[0] * step[0] + corner[1] * step[1] + corner[2] * step[2];
+						if (edges[v * 3 + axis] < 0) {
+							const float2 a = brick.voxels[v];
+							const float2 b = brick.voxels[v + step[axis]];
+							float3 p = make_float3(x + corner[0], y + corner[1], z + corner[2]);
+							(&p.x)[axis] += a.x / (a.x - b.x);
+							edges[v * 3 + axis] = mesh.vertices.size();
+							mesh.vertices.push_back(brick.corner + p * brick.voxelSize);
+						}
+						(&triangle.x)[k] = edges[v * 3 + axis];
+					}
+					mesh.triangles.push_back(triangle);
+				}
+			}
+}
+
+// Persistent surface kept per brick, each brick remembers the store version it last changed in
+class MeshStore {
+public:
+	MeshStore(uint bricks) : meshes(bricks), changed(bricks, 0), version(0) {
+	}
+
+	void update(const std::vector<uint> & ids, std::vector<BrickMesh> & fresh) {
+		std::lock_guard<std::mutex> guard(lock);
+		version++;
+		for (uint i = 0; i < ids.size(); i++) {
+			meshes[ids[i]].vertices.swap(fresh[i].vertices);
+			meshes[ids[i]].triangles.swap(fresh[i].triangles);
+			changed[ids[i]] = version;
+		}
+	}
+
+	// bricks changed after version since, an emptied brick comes with an empty mesh;
+	// returns the version to ask from next time
+	uint delta(uint since, std::vector<uint> & ids, std::vector<BrickMesh> & out) const {
+		std::lock_guard<std::mutex> guard(lock);
+		ids.clear();
+		out.clear();
+		for (uint i = 0; i < changed.size(); i++)
+			if (changed[i] > since) {
+				ids.push_back(i);
+				out.push_back(meshes[i]);
+			}
+		return version;
+	}
+
+private:
+	std::vector<BrickMesh> meshes;
+	std::vector<uint> changed;
+	uint version;
+	mutable std::mutex lock;
+};
+
+// Re-meshes the submitted bricks on its own thread, a brick submitted again before its turn is only meshed once
+class LiveMesher {
+public:
+	MeshStore store;
+
+	LiveMesher(uint bricks) : store(bricks), slot(bricks, -1), busy(false), stop(false),
+			worker(&LiveMesher::run, this) {
+	}
+
+	~LiveMesher() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stop = true;
+		}
+		wake.notify_all();
+		worker.join();
+	}
+
+	// Snapshot and clear the dirty bricks, the cost follows their number and not the volume size
+	template<typename F>
+	void submit(const VolumeT<F> & vol, char * dirty) {
+		const uint3 bricks = vol.bricks();
+		std::vector<VoxelBrick> fresh;
+		uint3 b;
+		for (b.z = 0; b.z < bricks.z; b.z++)
+			for (b.y = 0; b.y < bricks.y; b.y++)
+				for (b.x = 0; b.x < bricks.x; b.x++) {
+					const uint i = b.x + b.y * bricks.x + b.z * bricks.x * bricks.y;
+					if (!dirty[i])
+						continue;
+					dirty[i] = 0;
+					fresh.resize(fresh.size() + 1);
+					fresh.back().copy(vol, b, i);
+				}
+		if (fresh.empty())
+			return;
+		std::lock_guard<std::mutex> guard(lock);
+		for (uint i = 0; i < fresh.size(); i++) {
+			int & s = slot[fresh[i].id];
+			if (s < 0) {
+				s = pending.size();
+				pending.push_back(fresh[i]);
+			} else
+				pending[s] = fresh[i];
+		}
+		wake.notify_all();
+	}
+
+	// Wait for the bricks submitted so far
+	void flush() {
+		std::unique_lock<std::mutex> guard(lock);
+		while (busy || !pending.empty())
+			wake.wait(guard);
+	}
+
+private:
+	std::vector<VoxelBrick> pending;
+	std::vector<int> slot; // position of each brick in pending, -1 when not there
+	bool busy;
+	bool stop;
+	std::mutex lock;
+	std::condition_variable wake;
+	std::thread worker;
+
+	void run() {
+		std::vector<VoxelBrick> work;
+		std::vector<uint> ids;
+		std::vector<BrickMesh> meshes;
+		std::unique_lock<std::mutex> guard(lock);
+		while (true) {
+			while (!stop && pending.empty())
+				wake.wait(guard);
+			if (stop)
+				break;
+			work.swap(pending);
+			for (uint i = 0; i < work.size(); i++)
+				slot[work[i].id] = -1;
+			busy = true;
+			guard.unlock();
+
+			ids.resize(work.size());
+			meshes.resize(work.size());
+			for (uint i = 0; i < work.size(); i++) {
+				ids[i] = work[i].id;
+				marchingCubesBrick(work[i], meshes[i]);
+			}
+			store.update(ids, meshes);
+			work.clear();
+
+			guard.lock();
+			busy = false;
+			wake.notify_all();
+		}
+	}
+};
+
+// Binary little endian PLY with float vertices and int triangle indices
+inline void writePLY(const char * filename, const std::vector<float3> & vertices,
+		const std::vector<uint3> & triangles) {
+	std::ofstream file(filename, std::ios::out | std::ios::binary);
+	if (file.fail()) {
+		std::cout << "Error opening file: " << filename << std::endl;
+		exit(1);
+	}
+	file << "ply\n" << "format binary_little_endian 1.0\n"
+			<< "element vertex " << vertices.size() << "\n"
+			<< "property float x\n" << "property float y\n" << "property float z\n"
+			<< "element face " << triangles.size() << "\n"
+			<< "property list uchar int vertex_indices\n" << "end_header\n";
+	if (!vertices.empty())
+		file.write((const char *) &vertices[0], vertices.size() * sizeof(float3));
+	std::vector<char> faces(triangles.size() * 13);
+	for (uint i = 0; i < triangles.size(); i++) {
+		faces[i * 13] = 3;
+		memcpy(&faces[i * 13 + 1], &triangles[i], 12);
+	}
+	if (!faces.empty())
+		file.write(&faces[0], faces.size());
+	file.close();
+}
+
+#endif /* MARCHING_CUBES_H_ */
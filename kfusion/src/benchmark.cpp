@@ -8,6 +8,7 @@
  */
 
 #include <kernels.h>
+#include <marching_cubes.h>
 #include <interface.h>
 #include <stdint.h>
 #include <vector>
@@ -27,8 +28,7 @@
 // #include <thread>
 // #include <omp.h>
 
-inline double benchmark_tock() {
-	synchroniseDevices();
+inline double host_clock() {
 #ifdef __APPLE__
 		clock_serv_t cclock;
 		mach_timespec_t clockData;
@@ -42,6 +42,41 @@ inline double benchmark_tock() {
 		return (double) clockData.tv_sec + clockData.tv_nsec / 1000000000.0;
 }	
 
+inline double benchmark_tock() {
+	synchroniseDevices();
+	return host_clock();
+}
+
+// Page-aligned allocation, so that the OpenCL runtime can use the buffer in place (--zero-copy)
+inline void * page_malloc(size_t size) {
+	void * ptr = NULL;
+	if (posix_memalign(&ptr, 4096, size) != 0) {
+		std::cerr << "Host buffer allocation failed." << std::endl;
+		exit(1);
+	}
+	return ptr;
+}
+
+// Camera positions of an ICL-NUIM trajectory in freiburg format (index tx ty tz qx qy qz qw)
+std::vector<float3> read_ground_truth(std::string filename) {
+	std::vector<float3> positions;
+	std::ifstream file(filename.c_str());
+	if (file.fail()) {
+		std::cerr << "Error opening ground truth file: " << filename << std::endl;
+		exit(1);
+	}
+	std::string line;
+	while (std::getline(file, line)) {
+		std::istringstream fields(line);
+		int index;
+		float3 p;
+		if (!(fields >> index >> p.x >> p.y >> p.z))
+			break;
+		positions.push_back(p);
+	}
+	return positions;
+}
+
 
 
 /***
@@ -129,13 +164,13 @@ int main(int argc, char ** argv) {
 	//  =========  BASIC BUFFERS  (input / output )  =========
 
 	// Construction Scene reader and input buffer
-	uint16_t* inputDepth = (uint16_t*) malloc(
+	uint16_t* inputDepth = (uint16_t*) page_malloc(
 			sizeof(uint16_t) * inputSize.x * inputSize.y);
-	uchar4* depthRender = (uchar4*) malloc(
+	uchar4* depthRender = (uchar4*) page_malloc(
 			sizeof(uchar4) * computationSize.x * computationSize.y);
-	uchar4* trackRender = (uchar4*) malloc(
+	uchar4* trackRender = (uchar4*) page_malloc(
 			sizeof(uchar4) * computationSize.x * computationSize.y);
-	uchar4* volumeRender = (uchar4*) malloc(
+	uchar4* volumeRender = (uchar4*) page_malloc(
 			sizeof(uchar4) * computationSize.x * computationSize.y);
 
 	uint frame = 0;
@@ -145,8 +180,50 @@ int main(int argc, char ** argv) {
 	double* timingsCPU = (double *) malloc(13 * sizeof(double));
 	double* timingsCustom = (double *) calloc(256, sizeof(double));
 	double startOfKernel, endOfKernel, computationTotalIO, computationTotalCPU, computationTotalCustom, overallTotalIO, overallTotalCPU, overallTotalCustom;
+	setZeroCopy(config.zero_copy);
+	setDevicePlacement(config.device_placement);
+	setIntegrationSplit(config.integration_split);
+	setSpecialisedKernels(config.specialise_kernels, config.mu);
+	setRollingVolume(config.rolling_threshold, config.evicted_file);
+	setLiveMesh(config.live_mesh);
+	setVolumeFile(config.volume_file);
+	setBandIntegration(config.band_integration);
+	setMotionModel(config.motion_damping);
+	setAdaptiveIcp(config.adaptive_icp);
+	setIcpSampling(config.icp_sampling, config.icp_samples);
+	setReferencePyramid(config.reference_pyramid);
+	setRaycastRatio(config.raycast_ratio);
+	// backend initialisation (device setup, program builds) is kept out of the per-frame timings
+	double startOfInit = host_clock();
 	Kfusion kfusion(computationSize, config.volume_resolution,
 			config.volume_size, init_pose, config.pyramid, timingsIO, timingsCPU, logstreamCustom, logstreamBuffers);
+	std::cerr << "initialisation time: " << benchmark_tock() - startOfInit << std::endl;
+
+	// resume: restore the volume and pose, skip the frames already integrated and raycast the reference
+	if (config.resume_file != "") {
+		double startOfResume = host_clock();
+		const uint resumeFrame = kfusion.loadCheckpoint(config.resume_file.c_str());
+		for (; frame < resumeFrame; frame++)
+			if (!reader->readNextDepthFrame(inputDepth)) {
+				std::cerr << "The input ends before frame " << resumeFrame << " of the checkpoint" << std::endl;
+				exit(1);
+			}
+		kfusion.raycasting(camera, config.mu, frame);
+		std::cerr << "resumed at frame " << frame << " in " << benchmark_tock() - startOfResume << std::endl;
+	}
+
+	// accuracy report, positions are shifted the same way as checkPos.py
+	std::vector<float3> groundTruth;
+	double ateTotal = 0.0, ateMax = 0.0;
+	uint ateFrames = 0;
+
+	// live mesh as pulled by a consumer
+	uint meshVersion = 0;
+	size_t meshUpdates = 0;
+	std::vector<uint> meshBricks;
+	std::vector<BrickMesh> meshDelta;
+	if (config.ground_truth_file != "")
+		groundTruth = read_ground_truth(config.ground_truth_file);
 
 	*logstreamIO
 			<< "frame\tacquisition\tpreprocess_mm2meters\tpreprocess_bilateralFilter\ttrack_halfSample\ttrack_depth2vertex\ttrack_vertex2normal"
@@ -173,6 +250,16 @@ int main(int argc, char ** argv) {
 		float yt = pose.data[1].w - init_pose.y;
 		float zt = pose.data[2].w - init_pose.z;
 
+		if (frame < groundTruth.size()) {
+			const float3 first = groundTruth[0];
+			const float3 diff = make_float3(xt + first.x, -(yt + first.y),
+					zt + first.z) - groundTruth[frame];
+			const double ate = length(diff);
+			ateTotal += ate;
+			ateMax = std::max(ateMax, ate);
+			ateFrames++;
+		}
+
 		endOfKernel = benchmark_tock();
 		timingsIO[0] = endOfKernel - startOfKernel;
 
@@ -245,8 +332,18 @@ int main(int argc, char ** argv) {
 				<< tracked << "        \t" << integrated // tracked and integrated flags
 				<< std::endl;
 
+		// act as a live mesh consumer, pulling the bricks changed since the last frame
+		if (config.live_mesh) {
+			meshVersion = kfusion.meshDelta(meshVersion, meshBricks, meshDelta);
+			meshUpdates += meshBricks.size();
+		}
+
 		frame++;
 
+		if (config.checkpoint_file != "" && config.checkpoint_rate > 0
+				&& frame % config.checkpoint_rate == 0)
+			kfusion.saveCheckpoint(config.checkpoint_file.c_str(), frame);
+
 		startOfKernel = benchmark_tock();
 	}
 	// ==========     DUMP VOLUME      =========
@@ -255,6 +352,40 @@ int main(int argc, char ** argv) {
 	  kfusion.dumpVolume(config.dump_volume_file.c_str());
 	}
 
+	if (config.mesh_file != "") {
+		kfusion.dumpMesh(config.mesh_file.c_str());
+	}
+
+	if (config.checkpoint_file != "") {
+		double startOfCheckpoint = host_clock();
+		kfusion.saveCheckpoint(config.checkpoint_file.c_str(), frame);
+		std::cout << "Checkpoint of frame " << frame << " saved on file: " << config.checkpoint_file
+				<< " in " << benchmark_tock() - startOfCheckpoint << " s" << std::endl;
+	}
+
+	if (config.live_mesh) {
+		kfusion.meshDelta(0, meshBricks, meshDelta, true);
+		size_t triangles = 0, bricks = 0;
+		for (uint i = 0; i < meshDelta.size(); i++) {
+			triangles += meshDelta[i].triangles.size();
+			bricks += !meshDelta[i].triangles.empty();
+		}
+		std::cout << "live mesh: " << meshUpdates << " brick updates pulled, "
+				<< triangles << " triangles in " << bricks << " bricks" << std::endl;
+	}
+
+	if (config.ground_truth_file != "") {
+		const size_t voxels = (size_t) config.volume_resolution.x
+				* config.volume_resolution.y * config.volume_resolution.z;
+		std::cout << "volume format: " << Volume::format::name() << std::endl;
+		std::cout << "volume memory: "
+				<< voxels * (sizeof(Volume::tsdf_type) + sizeof(Volume::weight_type))
+				<< " bytes" << std::endl;
+		if (ateFrames > 0)
+			std::cout << "ATE mean: " << ateTotal / ateFrames << " max: " << ateMax
+					<< " (" << ateFrames << " frames)" << std::endl;
+	}
+
 	//  =========  FREE BASIC BUFFERS  =========
 
 	free(timingsIO);
@@ -7,6 +7,15 @@
 
  */
 #include <kernels.h>
+#include <marching_cubes.h>
+#include <checkpoint.h>
+#include <arena.h>
+#include <icp_budget.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <dirent.h>
+#endif
 
 #ifdef __APPLE__
 #include <mach/clock.h>
@@ -41,8 +50,8 @@ float * gaussian;
 
 // inter-frame
 Volume volume;
-float3 * vertex;
-float3 * normal;
+PlanarPoints vertex;
+PlanarPoints normal;
 
 // intra-frame
 TrackData * trackingResult;
@@ -51,8 +60,68 @@ float ** ScaledDepth;
 float * floatDepth;
 Matrix4 oldPose;
 Matrix4 raycastPose;
-float3 ** inputVertex;
-float3 ** inputNormal;
+PlanarPoints * inputVertex;
+PlanarPoints * inputNormal;
+
+// raycast half sampled to the size of each pyramid level, the finest level being the raycast itself
+bool reference_pyramid = false;
+PlanarPoints * referenceVertex;
+PlanarPoints * referenceNormal;
+
+// pyramid level the raycast runs at, and the one it ran at last: after a frame that was not
+// tracked it runs at full resolution again
+uint raycast_level = 0;
+uint raycast_last = 0;
+bool raycast_refine = true;
+
+// ICP on a subset of the pixels of the larger levels, chosen once per frame
+IcpSampling icp_sampling = ICP_SAMPLING_ALL;
+uint icp_samples = 0;
+uint ** sampledPixels;
+uint * sampledCount;
+uint * sampledValid;
+TrackData * sampledResult;
+
+// sampled tracking results are laid out in rows of this many for reduceKernel
+static const uint samples_row = 64;
+
+inline uint2 samplesSize(uint count) {
+	return make_uint2(samples_row, (count + samples_row - 1) / samples_row);
+}
+
+// Image the last reduction's inliers are a share of: sampled, the pixels the samples stand for
+inline uint2 trackedSize(uint2 computationSize) {
+	if (sampledCount[0] == 0)
+		return computationSize;
+	return make_uint2((uint) ((double) sampledCount[0] * computationSize.x * computationSize.y
+			/ sampledValid[0]), 1);
+}
+
+// rolling volume, recentred by whole voxels once the camera drifts beyond the threshold
+float rolling_threshold = 0.0f; // 0 keeps the volume fixed
+float3 rolling_anchor;          // camera position relative to the volume corner at start
+std::ofstream rolling_evicted;
+
+// live mesh, integration marks the bricks it touches and the mesher re-extracts them
+bool live_mesh = false;
+char * dirty_bricks = NULL;
+LiveMesher * live_mesher = NULL;
+
+// pixel-driven integration, restricted to the bricks crossed by the truncation band
+bool band_integration = false;
+char * band_bricks = NULL;
+
+// file-backed volume, with the page faults of each frame
+std::string volume_file = "";
+struct rusage frame_usage;
+
+// motion model, the pose tracked the frame before last
+float motion_damping = -1.0f;
+Matrix4 motion_previous;
+
+// ICP iterations per level, moved between levels by their recent convergence when adaptive
+IcpBudget icp_budget;
+bool adaptive_icp = false;
 
 bool print_kernel_timing = false;
 #ifdef __APPLE__
@@ -64,76 +133,293 @@ bool print_kernel_timing = false;
 	struct timespec tock_clockData;
 #endif
 	
+// every buffer of the pipeline, carved from one huge-page allocation
+Arena arena;
+// On a NUMA machine the buffers first touched with the kernels' partition come from small pages
+// instead: a huge page spans the rows of several threads, and would be placed whole on the node of
+// the first one. One node keeps them in the huge-page arena, as there is no placement to lose.
+Arena small_page_arena(false);
+Arena * partitioned_arena = &arena;
+
+// NUMA nodes of the machine, 1 where it cannot tell
+int numaNodes() {
+	int nodes = 0;
+#ifdef __linux__
+	DIR * dir = opendir("/sys/devices/system/node");
+	if (dir == NULL)
+		return 1;
+	for (struct dirent * entry = readdir(dir); entry != NULL; entry = readdir(dir))
+		if (strncmp(entry->d_name, "node", 4) == 0 && isdigit(entry->d_name[4]))
+			nodes++;
+	closedir(dir);
+#endif
+	return std::max(nodes, 1);
+}
+
+// Zeroed image buffer, first touched row by row with the static partition of the image kernels,
+// so that on a NUMA machine the pages of each thread's rows live on its node; bytes may exceed the image
+void * imageAlloc(const char * name, size_t bytes, uint2 size, size_t pixelBytes) {
+	char * buffer = (char *) partitioned_arena->carve(name, bytes);
+	if (buffer == NULL)
+		return NULL;
+	const size_t rowBytes = size.x * pixelBytes;
+	const int rows = std::min((size_t) size.y, bytes / rowBytes);
+	int y;
+#pragma omp parallel for \
+        shared(buffer), private(y)
+	for (y = 0; y < rows; y++)
+		memset(buffer + y * rowBytes, 0, rowBytes);
+	memset(buffer + rows * rowBytes, 0, bytes - rows * rowBytes);
+	return buffer;
+}
+
+// One plane per coordinate
+PlanarPoints pointsAlloc(const char * name, uint2 size) {
+	const size_t bytes = sizeof(float) * size.x * size.y;
+	PlanarPoints points;
+	points.x = (float *) imageAlloc((std::string(name) + ".x").c_str(), bytes, size, sizeof(float));
+	points.y = (float *) imageAlloc((std::string(name) + ".y").c_str(), bytes, size, sizeof(float));
+	points.z = (float *) imageAlloc((std::string(name) + ".z").c_str(), bytes, size, sizeof(float));
+	return points;
+}
+
+// Per-node traffic of one kernel pass, estimated from the placement of the pages its static row
+// partition touches: bytes[from * nodes + to] are read or written by threads of node from in pages
+// of node to, and the bytes off the diagonal cross the interconnect. Hardware bandwidth counters
+// would need uncore PMU access, which the benchmark does not have.
+struct NumaTraffic {
+	typedef std::vector<std::pair<char *, size_t> > Spans; // bytes per page touched by one row
+
+	int nodes;
+	std::vector<size_t> bytes;
+
+	NumaTraffic() : nodes(numaNodes()), bytes(nodes * nodes, 0) {
+	}
+
+	// count bytes from address, split at the page boundaries
+	static void touch(Spans & spans, const void * address, size_t count) {
+		const size_t page = sysconf(_SC_PAGESIZE);
+		for (char * p = (char *) address; count > 0;) {
+			char * start = (char *) ((size_t) p / page * page);
+			const size_t n = std::min(count, (size_t) (start + page - p));
+			spans.push_back(std::make_pair(start, n));
+			p += n;
+			count -= n;
+		}
+	}
+
+	// adds the spans of a row, from the thread which touched them
+	void add(Spans & spans) {
+#ifdef __linux__
+		std::sort(spans.begin(), spans.end());
+		std::vector<void *> pages;
+		std::vector<size_t> counts;
+		for (size_t i = 0; i < spans.size(); i++) {
+			if (pages.empty() || pages.back() != spans[i].first) {
+				pages.push_back(spans[i].first);
+				counts.push_back(0);
+			}
+			counts.back() += spans[i].second;
+		}
+		unsigned int cpu, from;
+		std::vector<int> status(pages.size(), -1);
+		if (pages.empty() || syscall(SYS_getcpu, &cpu, &from, NULL) != 0
+				|| syscall(SYS_move_pages, 0, pages.size(), &pages[0], NULL, &status[0], 0) != 0)
+			return;
+#pragma omp critical
+		for (size_t i = 0; i < pages.size(); i++)
+			if (status[i] >= 0 && status[i] < nodes && (int) from < nodes)
+				bytes[from * nodes + status[i]] += counts[i];
+#endif
+	}
+
+	void print(const char * kernel) const {
+		size_t local = 0, remote = 0;
+		std::cerr << "numaTraffic " << kernel;
+		for (int from = 0; from < nodes; from++)
+			for (int to = 0; to < nodes; to++) {
+				(from == to ? local : remote) += bytes[from * nodes + to];
+				std::cerr << " node" << from << "<-node" << to << ":" << bytes[from * nodes + to];
+			}
+		std::cerr << " local:" << local << " remote:" << remote << std::endl;
+	}
+};
+
+// integrateKernel updates the columns of each volume row y in both arrays
+void reportIntegrateTraffic(const Volume & volume) {
+	NumaTraffic traffic;
+	int y;
+#pragma omp parallel for \
+        shared(traffic), private(y)
+	for (y = 0; y < (int) volume.size.y; y++) {
+		NumaTraffic::Spans spans;
+		for (uint z = 0; z < volume.size.z; z++)
+			for (uint x = 0; x < volume.size.x; x++) {
+				const size_t i = volume.index(x, y, z);
+				NumaTraffic::touch(spans, &volume.data[i], sizeof(Volume::tsdf_type));
+				NumaTraffic::touch(spans, &volume.weight[i], sizeof(Volume::weight_type));
+			}
+		traffic.add(spans);
+	}
+	traffic.print("integrateKernel");
+}
+
+// raycastKernel writes each row of the vertex and normal planes
+void reportRaycastTraffic(const PlanarPoints vertex, const PlanarPoints normal, uint2 size) {
+	NumaTraffic traffic;
+	int y;
+#pragma omp parallel for \
+        shared(traffic), private(y)
+	for (y = 0; y < (int) size.y; y++) {
+		NumaTraffic::Spans spans;
+		const size_t row = y * size.x;
+		const size_t rowBytes = size.x * sizeof(float);
+		NumaTraffic::touch(spans, vertex.x + row, rowBytes);
+		NumaTraffic::touch(spans, vertex.y + row, rowBytes);
+		NumaTraffic::touch(spans, vertex.z + row, rowBytes);
+		NumaTraffic::touch(spans, normal.x + row, rowBytes);
+		NumaTraffic::touch(spans, normal.y + row, rowBytes);
+		NumaTraffic::touch(spans, normal.z + row, rowBytes);
+		traffic.add(spans);
+	}
+	traffic.print("raycastKernel");
+}
+
 void Kfusion::languageSpecificConstructor() {
 
 	if (getenv("KERNEL_TIMINGS"))
 		print_kernel_timing = true;
 
-	// internal buffers to initialize
-	reductionoutput = (float*) calloc(sizeof(float) * 8 * 32, 1);
+	if (raycast_level >= iterations.size()) {
+		std::cerr << "Raycast ratio limited to the coarsest pyramid level" << std::endl;
+		raycast_level = iterations.size() - 1;
+	}
 
 	ScaledDepth = (float**) calloc(sizeof(float*) * iterations.size(), 1);
-	inputVertex = (float3**) calloc(sizeof(float3*) * iterations.size(), 1);
-	inputNormal = (float3**) calloc(sizeof(float3*) * iterations.size(), 1);
-
-	for (unsigned int i = 0; i < iterations.size(); ++i) {
-		ScaledDepth[i] = (float*) calloc(
-				sizeof(float) * (computationSize.x * computationSize.y)
-						/ (int) pow(2, i), 1);
-		inputVertex[i] = (float3*) calloc(
-				sizeof(float3) * (computationSize.x * computationSize.y)
-						/ (int) pow(2, i), 1);
-		inputNormal[i] = (float3*) calloc(
-				sizeof(float3) * (computationSize.x * computationSize.y)
-						/ (int) pow(2, i), 1);
+	inputVertex = (PlanarPoints*) calloc(sizeof(PlanarPoints) * iterations.size(), 1);
+	inputNormal = (PlanarPoints*) calloc(sizeof(PlanarPoints) * iterations.size(), 1);
+	referenceVertex = (PlanarPoints*) calloc(sizeof(PlanarPoints) * iterations.size(), 1);
+	referenceNormal = (PlanarPoints*) calloc(sizeof(PlanarPoints) * iterations.size(), 1);
+	sampledPixels = (uint**) calloc(sizeof(uint*) * iterations.size(), 1);
+	sampledCount = (uint*) calloc(sizeof(uint) * iterations.size(), 1);
+	sampledValid = (uint*) calloc(sizeof(uint) * iterations.size(), 1);
+
+	// internal buffers, the first pass sizes the arenas and the second one carves them
+	partitioned_arena = (numaNodes() > 1) ? &small_page_arena : &arena;
+	const size_t voxels = Volume::voxels(volumeResolution);
+	const uint3 bricks = make_uint3((volumeResolution.x + brick_size - 1) / brick_size,
+			(volumeResolution.y + brick_size - 1) / brick_size,
+			(volumeResolution.z + brick_size - 1) / brick_size);
+	size_t gaussianS = radius * 2 + 1;
+	for (int pass = 0; pass < 2; pass++) {
+		if (pass == 1) {
+			arena.reserve();
+			if (partitioned_arena != &arena)
+				partitioned_arena->reserve();
+		}
+		arena.rewind();
+		partitioned_arena->rewind();
+
+		reductionoutput = (float*) arena.carve("reductionoutput", sizeof(float) * 8 * 32);
+		for (unsigned int i = 0; i < iterations.size(); ++i) {
+			const uint2 levelSize = make_uint2(computationSize.x >> i, computationSize.y >> i);
+			ScaledDepth[i] = (float*) imageAlloc("ScaledDepth",
+					sizeof(float) * (computationSize.x * computationSize.y)
+							/ (int) pow(2, i), levelSize, sizeof(float));
+			inputVertex[i] = pointsAlloc("inputVertex", levelSize);
+			inputNormal[i] = pointsAlloc("inputNormal", levelSize);
+			if ((reference_pyramid || i == raycast_level) && i > 0) {
+				referenceVertex[i] = pointsAlloc("referenceVertex", levelSize);
+				referenceNormal[i] = pointsAlloc("referenceNormal", levelSize);
+			}
+			if (icp_sampling != ICP_SAMPLING_ALL)
+				sampledPixels[i] = (uint*) arena.carve("sampledPixels",
+						sizeof(uint) * levelSize.x * levelSize.y);
+		}
+		if (icp_sampling != ICP_SAMPLING_ALL)
+			sampledResult = (TrackData*) arena.carve("sampledResult",
+					sizeof(TrackData) * (computationSize.x * computationSize.y + samples_row));
+
+		floatDepth = (float*) imageAlloc("floatDepth",
+				sizeof(float) * computationSize.x * computationSize.y, computationSize, sizeof(float));
+		vertex = pointsAlloc("vertex", computationSize);
+		normal = pointsAlloc("normal", computationSize);
+		referenceVertex[0] = vertex;
+		referenceNormal[0] = normal;
+		trackingResult = (TrackData*) imageAlloc("trackingResult",
+				sizeof(TrackData) * computationSize.x * computationSize.y, computationSize, sizeof(TrackData));
+		gaussian = (float*) arena.carve("gaussian", gaussianS * sizeof(float));
+
+		// a file-backed volume stays out of the arena
+		if (volume_file == "") {
+			Volume::tsdf_type * tsdf = (Volume::tsdf_type *) partitioned_arena->carve("volume.data",
+					voxels * sizeof(Volume::tsdf_type));
+			Volume::weight_type * weights = (Volume::weight_type *) partitioned_arena->carve("volume.weight",
+					voxels * sizeof(Volume::weight_type));
+			volume.init(volumeResolution, volumeDimensions, tsdf, weights);
+		}
+		if (live_mesh)
+			dirty_bricks = (char *) arena.carve("dirty_bricks", bricks.x * bricks.y * bricks.z);
+		if (band_integration)
+			band_bricks = (char *) arena.carve("band_bricks", bricks.x * bricks.y * bricks.z);
 	}
-
-	floatDepth = (float*) calloc(
-			sizeof(float) * computationSize.x * computationSize.y, 1);
-	vertex = (float3*) calloc(
-			sizeof(float3) * computationSize.x * computationSize.y, 1);
-	normal = (float3*) calloc(
-			sizeof(float3) * computationSize.x * computationSize.y, 1);
-	trackingResult = (TrackData*) calloc(
-			sizeof(TrackData) * computationSize.x * computationSize.y, 1);
+	arena.print(std::cerr);
+	if (partitioned_arena != &arena)
+		partitioned_arena->print(std::cerr);
 
 	// ********* BEGIN : Generate the gaussian *************
-	size_t gaussianS = radius * 2 + 1;
-	gaussian = (float*) calloc(gaussianS * sizeof(float), 1);
 	int x;
 	for (unsigned int i = 0; i < gaussianS; i++) {
-		x = i - 2;
+		x = i - radius;
 		gaussian[i] = expf(-(x * x) / (2 * delta * delta));
 	}
 	// ********* END : Generate the gaussian *************
 
-	volume.init(volumeResolution, volumeDimensions);
-	reset();
+	if (volume_file != "")
+		volume.init(volumeResolution, volumeDimensions, volume_file.c_str());
+	getrusage(RUSAGE_SELF, &frame_usage);
+	rolling_anchor = get_translation(pose);
+	motion_previous = pose;
+	icp_budget.init(iterations);
+	if (live_mesh) {
+		memset(dirty_bricks, 0, bricks.x * bricks.y * bricks.z);
+		live_mesher = new LiveMesher(bricks.x * bricks.y * bricks.z);
+	}
+	// a freshly truncated volume file reads as zero weights, i.e. unobserved voxels, and writing
+	// every voxel would fault the whole file in
+	if (volume.mapped == 0)
+		reset();
+	if (print_kernel_timing) {
+		reportIntegrateTraffic(volume);
+		reportRaycastTraffic(vertex, normal, computationSize);
+	}
 }
 
 Kfusion::~Kfusion() {
 
-	free(floatDepth);
-	free(trackingResult);
-
-	free(reductionoutput);
-	for (unsigned int i = 0; i < iterations.size(); ++i) {
-		free(ScaledDepth[i]);
-		free(inputVertex[i]);
-		free(inputNormal[i]);
-	}
 	free(ScaledDepth);
 	free(inputVertex);
 	free(inputNormal);
-
-	free(vertex);
-	free(normal);
-	free(gaussian);
-
+	free(referenceVertex);
+	free(referenceNormal);
+	free(sampledPixels); // the samples themselves are carved from the arena
+	free(sampledCount);
+	free(sampledValid);
+
+	delete live_mesher;
+	live_mesher = NULL;
+	dirty_bricks = NULL;
+	band_bricks = NULL;
 	volume.release();
+	arena.release();
+	small_page_arena.release();
 }
 void Kfusion::reset() {
 	initVolumeKernel(volume);
+	if (dirty_bricks) {
+		const uint3 bricks = volume.bricks();
+		memset(dirty_bricks, 1, bricks.x * bricks.y * bricks.z);
+	}
 }
 void init() {
 }
@@ -144,108 +430,280 @@ void clean() {
 ;
 // stub
 
+// Rows of y are spread over the threads as in integrateKernel, whose writes then stay on the
+// NUMA node of the thread which first touched their pages here
 void initVolumeKernel(Volume volume) {
 	TICK();
-	for (unsigned int x = 0; x < volume.size.x; x++)
-		for (unsigned int y = 0; y < volume.size.y; y++) {
-			for (unsigned int z = 0; z < volume.size.z; z++) {
-				//std::cout <<  x << " " << y << " " << z <<"\n";
+	int y;
+#pragma omp parallel for \
+        shared(volume), private(y)
+	for (y = 0; y < (int) volume.size.y; y++)
+		for (unsigned int z = 0; z < volume.size.z; z++)
+			for (unsigned int x = 0; x < volume.size.x; x++)
 				volume.setints(x, y, z, make_float2(1.0f, 0.0f));
+	TOCK("initVolumeKernel", volume.size.x * volume.size.y * volume.size.z);
+}
+
+// One filtered pixel, clamping the taps at the image border
+inline float bilateralPixel(const float* in, uint2 size, const float * gaussian,
+		float e_d_squared_2, uint x, uint y, int r) {
+	const uint pos = x + y * size.x;
+	if (in[pos] == 0)
+		return 0;
+
+	float sum = 0.0f;
+	float t = 0.0f;
+
+	const float center = in[pos];
+
+	for (int i = -r; i <= r; ++i) {
+		for (int j = -r; j <= r; ++j) {
+			uint2 curPos = make_uint2(clamp(x + i, 0u, size.x - 1),
+					clamp(y + j, 0u, size.y - 1));
+			const float curPix = in[curPos.x + curPos.y * size.x];
+			if (curPix > 0) {
+				const float mod = sq(curPix - center);
+				const float factor = gaussian[i + r]
+						* gaussian[j + r]
+						* expf(-mod / e_d_squared_2);
+				t += factor * curPix;
+				sum += factor;
 			}
 		}
-	TOCK("initVolumeKernel", volume.size.x * volume.size.y * volume.size.z);
+	}
+	return t / sum;
 }
 
-void bilateralFilterKernel(float* out, const float* in, uint2 size,
+// Scalar reference, used for every radius but the compile-time one
+void bilateralFilterReference(float* out, const float* in, uint2 size,
 		const float * gaussian, float e_d, int r) {
-	TICK()
-		uint y;
-		float e_d_squared_2 = e_d * e_d * 2;
+	uint y;
+	float e_d_squared_2 = e_d * e_d * 2;
 #pragma omp parallel for \
-	    shared(out),private(y)   
-		for (y = 0; y < size.y; y++) {
-			for (uint x = 0; x < size.x; x++) {
-				uint pos = x + y * size.x;
-				if (in[pos] == 0) {
-					out[pos] = 0;
-					continue;
-				}
+	    shared(out),private(y)
+	for (y = 0; y < size.y; y++)
+		for (uint x = 0; x < size.x; x++)
+			out[x + y * size.x] = bilateralPixel(in, size, gaussian, e_d_squared_2, x, y, r);
+}
 
-				float sum = 0.0f;
-				float t = 0.0f;
-
-				const float center = in[pos];
-
-				for (int i = -r; i <= r; ++i) {
-					for (int j = -r; j <= r; ++j) {
-						uint2 curPos = make_uint2(clamp(x + i, 0u, size.x - 1),
-								clamp(y + j, 0u, size.y - 1));
-						const float curPix = in[curPos.x + curPos.y * size.x];
-						if (curPix > 0) {
-							const float mod = sq(curPix - center);
-							const float factor = gaussian[i + r]
-									* gaussian[j + r]
-									* expf(-mod / e_d_squared_2);
-							t += factor * curPix;
-							sum += factor;
-						}
-					}
+// exp(-a) for 0 <= a < 2^31, within 3e-7 relative, in branch-free arithmetic the compiler vectorises:
+// 2^x split into its integer part, set as the exponent bits, and a polynomial of the fraction
+inline float expNegative(float a) {
+	const float x = a * -1.44269504f;
+	int n = (int) x;
+	n -= ((float) n > x);
+	const float f = x - (float) n;
+	const float p = 1.0f + f * (0.693147182f + f * (0.240226507f + f * (0.0555041087f
+			+ f * (0.00961812911f + f * 0.00133335581f))));
+	union {
+		int i;
+		float f;
+	} scale;
+	scale.i = (n < -126) ? 0 : (n + 127) << 23;
+	return p * scale.f;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(__APPLE__) && !defined(__clang__)
+#define KFUSION_SIMD_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define KFUSION_SIMD_CLONES
+#endif
+
+// Interior of row y for a compile-time radius: no clamping, the taps run over a block of pixels at a time
+static const int bilateral_block = 64;
+
+template<int R>
+KFUSION_SIMD_CLONES
+void bilateralFilterInterior(float* outRow, const float* in, uint2 size,
+		const float * gaussian, float inv_e_d_squared_2, uint y) {
+	for (uint x0 = R; x0 < size.x - R; x0 += bilateral_block) {
+		const uint n = std::min((uint) bilateral_block, size.x - R - x0);
+		const float * center = in + x0 + y * size.x;
+		float t[bilateral_block];
+		float sum[bilateral_block];
+		for (uint k = 0; k < n; k++) {
+			t[k] = 0.0f;
+			sum[k] = 0.0f;
+		}
+		for (int j = -R; j <= R; ++j)
+			for (int i = -R; i <= R; ++i) {
+				const float g = gaussian[i + R] * gaussian[j + R];
+				const float * tap = center + i + j * (int) size.x;
+				for (uint k = 0; k < n; k++) {
+					const float curPix = tap[k];
+					const float d = curPix - center[k];
+					// a select, not a branch around the multiply, keeps the loop vectorisable
+					const float factor = ((curPix > 0) ? g : 0.0f) * expNegative(d * d * inv_e_d_squared_2);
+					t[k] += factor * curPix;
+					sum[k] += factor;
 				}
-				out[pos] = t / sum;
 			}
+		for (uint k = 0; k < n; k++) {
+			const float filtered = t[k] / sum[k];
+			outRow[x0 + k] = (center[k] == 0) ? 0.0f : filtered;
 		}
-		TOCK("bilateralFilterKernel", size.x * size.y);
+	}
 }
 
-void depth2vertexKernel(float3* vertex, const float * depth, uint2 imageSize,
-		const Matrix4 invK) {
-	TICK();
-	unsigned int x, y;
+void bilateralFilterKernel(float* out, const float* in, uint2 size,
+		const float * gaussian, float e_d, int r) {
+	TICK()
+	if (r != radius || size.x <= 2 * radius || size.y <= 2 * radius) {
+		bilateralFilterReference(out, in, size, gaussian, e_d, r);
+	} else {
+		const float e_d_squared_2 = e_d * e_d * 2;
+		int y;
 #pragma omp parallel for \
-         shared(vertex), private(x, y)
-	for (y = 0; y < imageSize.y; y++) {
-		for (x = 0; x < imageSize.x; x++) {
-
-			if (depth[x + y * imageSize.x] > 0) {
-				vertex[x + y * imageSize.x] = depth[x + y * imageSize.x]
-						* (rotate(invK, make_float3(x, y, 1.f)));
-			} else {
-				vertex[x + y * imageSize.x] = make_float3(0);
+	    shared(out),private(y)
+		for (y = 0; y < (int) size.y; y++) {
+			if (y < radius || y >= (int) size.y - radius) {
+				for (uint x = 0; x < size.x; x++)
+					out[x + y * size.x] = bilateralPixel(in, size, gaussian, e_d_squared_2, x, y, radius);
+				continue;
 			}
+			for (uint x = 0; x < (uint) radius; x++) {
+				out[x + y * size.x] = bilateralPixel(in, size, gaussian, e_d_squared_2, x, y, radius);
+				out[size.x - 1 - x + y * size.x] = bilateralPixel(in, size, gaussian, e_d_squared_2,
+						size.x - 1 - x, y, radius);
+			}
+			bilateralFilterInterior<radius>(out + y * size.x, in, size, gaussian, 1.0f / e_d_squared_2, y);
 		}
 	}
-	TOCK("depth2vertexKernel", imageSize.x * imageSize.y);
+	TOCK("bilateralFilterKernel", size.x * size.y);
 }
 
-void vertex2normalKernel(float3 * out, const float3 * in, uint2 imageSize) {
-	TICK();
-	unsigned int x, y;
-#pragma omp parallel for \
-        shared(out), private(x,y)
-	for (y = 0; y < imageSize.y; y++) {
-		for (x = 0; x < imageSize.x; x++) {
-			const uint2 pleft = make_uint2(max(int(x) - 1, 0), y);
-			const uint2 pright = make_uint2(min(x + 1, (int) imageSize.x - 1),
-					y);
-			const uint2 pup = make_uint2(x, max(int(y) - 1, 0));
-			const uint2 pdown = make_uint2(x,
-					min(y + 1, ((int) imageSize.y) - 1));
-
-			const float3 left = in[pleft.x + imageSize.x * pleft.y];
-			const float3 right = in[pright.x + imageSize.x * pright.y];
-			const float3 up = in[pup.x + imageSize.x * pup.y];
-			const float3 down = in[pdown.x + imageSize.x * pdown.y];
-
-			if (left.z == 0 || right.z == 0 || up.z == 0 || down.z == 0) {
-				out[x + y * imageSize.x].x = KFUSION_INVALID;
-				continue;
+// Accuracy and speed of bilateralFilterKernel against the scalar reference, on one input
+void reportBilateralFilter(const float* in, uint2 size, const float * gaussian, float e_d) {
+	float * fast = (float *) malloc(sizeof(float) * size.x * size.y);
+	float * reference = (float *) malloc(sizeof(float) * size.x * size.y);
+	const bool timing = print_kernel_timing;
+	print_kernel_timing = false;
+	const int runs = 5;
+	struct timespec start, middle, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < runs; i++)
+		bilateralFilterKernel(fast, in, size, gaussian, e_d, radius);
+	clock_gettime(CLOCK_MONOTONIC, &middle);
+	for (int i = 0; i < runs; i++)
+		bilateralFilterReference(reference, in, size, gaussian, e_d, radius);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	print_kernel_timing = timing;
+
+	double maxError = 0, totalError = 0;
+	for (uint i = 0; i < size.x * size.y; i++) {
+		const double error = fabs(fast[i] - reference[i]);
+		maxError = std::max(maxError, error);
+		totalError += error;
+	}
+	const double fastTime = (middle.tv_sec - start.tv_sec) + (middle.tv_nsec - start.tv_nsec) * 1e-9;
+	const double referenceTime = (end.tv_sec - middle.tv_sec) + (end.tv_nsec - middle.tv_nsec) * 1e-9;
+	std::cerr << "bilateralFilterReport maxError " << maxError << " meanError "
+			<< totalError / (size.x * size.y) << " speedup " << referenceTime / fastTime << std::endl;
+	free(fast);
+	free(reference);
+}
+
+inline void vertexRow(float3 * out, const float * depth, uint2 imageSize,
+		const Matrix4 invK, uint y) {
+	for (uint x = 0; x < imageSize.x; x++) {
+		const float d = depth[x + y * imageSize.x];
+		out[x] = (d > 0) ? d * (rotate(invK, make_float3(x, y, 1.f))) : make_float3(0);
+	}
+}
+
+// Rows computed per band, each band back-projects the two rows around it once more
+static const uint vertex_band = 16;
+
+// Vertices and normals in one pass: each band slides a window of three vertex rows down the
+// image, storing every vertex row once and its normals as soon as the row below is
+// back-projected. Invalid normals are stored as (KFUSION_INVALID, 0, 0).
+template<typename Points>
+void depth2vertexNormal(Points vertex, Points normal, const float * depth,
+		uint2 imageSize, const Matrix4 invK) {
+	const int bands = (imageSize.y + vertex_band - 1) / vertex_band;
+#pragma omp parallel
+	{
+		std::vector<float3> window(3 * imageSize.x);
+		int b;
+#pragma omp for private(b)
+		for (b = 0; b < bands; b++) {
+			const uint y0 = b * vertex_band;
+			const uint y1 = std::min(y0 + vertex_band, imageSize.y);
+			float3 * up = &window[0];
+			float3 * row = &window[imageSize.x];
+			float3 * down = &window[2 * imageSize.x];
+			vertexRow(up, depth, imageSize, invK, max(int(y0) - 1, 0));
+			vertexRow(row, depth, imageSize, invK, y0);
+			for (uint y = y0; y < y1; y++) {
+				vertexRow(down, depth, imageSize, invK, min(y + 1, imageSize.y - 1));
+				for (uint x = 0; x < imageSize.x; x++) {
+					const uint i = x + y * imageSize.x;
+					vertex.set(i, row[x]);
+					const float3 left = row[max(int(x) - 1, 0)];
+					const float3 right = row[min(x + 1, imageSize.x - 1)];
+					if (left.z == 0 || right.z == 0 || up[x].z == 0 || down[x].z == 0) {
+						normal.set(i, make_float3(KFUSION_INVALID, 0, 0));
+						continue;
+					}
+					const float3 dxv = right - left;
+					const float3 dyv = down[x] - up[x];
+					normal.set(i, normalize(cross(dyv, dxv))); // switched dx and dy to get factor -1
+				}
+				float3 * recycled = up;
+				up = row;
+				row = down;
+				down = recycled;
 			}
-			const float3 dxv = right - left;
-			const float3 dyv = down - up;
-			out[x + y * imageSize.x] = normalize(cross(dyv, dxv)); // switched dx and dy to get factor -1
 		}
 	}
-	TOCK("vertex2normalKernel", imageSize.x * imageSize.y);
+}
+
+// Tracking reads planes, see trackPixels; reportPointLayouts times the padded layout against them
+void depth2vertexNormalKernel(PlanarPoints vertex, PlanarPoints normal, const float * depth,
+		uint2 imageSize, const Matrix4 invK) {
+	TICK();
+	depth2vertexNormal(vertex, normal, depth, imageSize, invK);
+	TOCK("depth2vertexNormalKernel", imageSize.x * imageSize.y);
+}
+
+// Speed of depth2vertexNormal writing padded float4 points against planes, on one input
+void reportPointLayouts(const float * depth, uint2 size, const Matrix4 invK) {
+	const size_t pixels = size.x * size.y;
+	PlanarPoints planarVertex, planarNormal;
+	float * planes = (float *) malloc(6 * sizeof(float) * pixels);
+	planarVertex.x = planes;
+	planarVertex.y = planes + pixels;
+	planarVertex.z = planes + 2 * pixels;
+	planarNormal.x = planes + 3 * pixels;
+	planarNormal.y = planes + 4 * pixels;
+	planarNormal.z = planes + 5 * pixels;
+	PaddedPoints paddedVertex, paddedNormal;
+	float4 * padded = (float4 *) malloc(2 * sizeof(float4) * pixels);
+	paddedVertex.p = padded;
+	paddedNormal.p = padded + pixels;
+
+	const int runs = 5;
+	struct timespec start, middle, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < runs; i++)
+		depth2vertexNormal(planarVertex, planarNormal, depth, size, invK);
+	clock_gettime(CLOCK_MONOTONIC, &middle);
+	for (int i = 0; i < runs; i++)
+		depth2vertexNormal(paddedVertex, paddedNormal, depth, size, invK);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	size_t mismatches = 0;
+	for (uint i = 0; i < pixels; i++) {
+		const float3 v = planarVertex.get(i) - paddedVertex.get(i);
+		const float3 n = planarNormal.get(i) - paddedNormal.get(i);
+		mismatches += (v.x != 0 || v.y != 0 || v.z != 0 || n.x != 0 || n.y != 0 || n.z != 0);
+	}
+	const double planarTime = (middle.tv_sec - start.tv_sec) + (middle.tv_nsec - start.tv_nsec) * 1e-9;
+	const double paddedTime = (end.tv_sec - middle.tv_sec) + (end.tv_nsec - middle.tv_nsec) * 1e-9;
+	std::cerr << "pointLayoutReport mismatches " << mismatches << " planar " << planarTime / runs
+			<< " padded " << paddedTime / runs << std::endl;
+	free(planes);
+	free(padded);
 }
 
 void new_reduce(int blockIndex, float * out, TrackData* J, const uint2 Jsize,
@@ -494,74 +952,214 @@ void reduceKernel(float * out, TrackData* J, const uint2 Jsize,
 	TOCK("reduceKernel", 512);
 }
 
-void trackKernel(TrackData* output, const float3* inVertex,
-		const float3* inNormal, uint2 inSize, const float3* refVertex,
-		const float3* refNormal, uint2 refSize, const Matrix4 Ttrack,
+// Pixels tracked per block: the first loop transforms and projects them, the second gathers their
+// reference points, both branch free so that they vectorise
+static const int track_block = 16;
+
+// n pixels from first on, or the n listed in samples, tracked into output
+template<bool Sampled>
+inline void trackPixels(TrackData* output, const uint* samples, uint first, uint n,
+		const PlanarPoints inVertex, const PlanarPoints inNormal,
+		const PlanarPoints refVertex, const PlanarPoints refNormal, uint2 refSize,
+		const Matrix4 Ttrack, const Matrix4 view, const float dist_threshold,
+		const float normal_threshold) {
+	int result[track_block];
+	uint reference[track_block];
+
+	for (uint k = 0; k < n; k++) {
+		const uint pixel = Sampled ? samples[k] : first + k;
+		const float3 projectedVertex = Ttrack * inVertex.get(pixel);
+		const float3 projectedPos = view * projectedVertex;
+		const float2 projPixel = make_float2(
+				projectedPos.x / projectedPos.z + 0.5f,
+				projectedPos.y / projectedPos.z + 0.5f);
+		const bool inside = (projPixel.x >= 0) & (projPixel.x <= refSize.x - 1)
+				& (projPixel.y >= 0) & (projPixel.y <= refSize.y - 1);
+		// pixels already rejected gather from the first reference pixel
+		const float px = inside ? projPixel.x : 0.0f;
+		const float py = inside ? projPixel.y : 0.0f;
+		reference[k] = (uint) px + (uint) py * refSize.x;
+		result[k] = (inNormal.x[pixel] == KFUSION_INVALID) ? -1 : (inside ? 0 : -2);
+	}
+
+	TrackData block[track_block];
+	for (uint k = 0; k < n; k++) {
+		const uint pixel = Sampled ? samples[k] : first + k;
+		const float3 projectedVertex = Ttrack * inVertex.get(pixel);
+		const float3 referenceNormal = refNormal.get(reference[k]);
+		const float3 diff = refVertex.get(reference[k]) - projectedVertex;
+		const float3 projectedNormal = rotate(Ttrack, inNormal.get(pixel));
+		const float3 rotation = cross(projectedVertex, referenceNormal);
+		const bool invalid = referenceNormal.x == KFUSION_INVALID;
+		// squared, as sqrtf keeps a branch for errno
+		const bool far = dot(diff, diff) > dist_threshold * dist_threshold;
+		const bool turned = dot(projectedNormal, referenceNormal) < normal_threshold;
+
+		// in reverse order of precedence, selects rather than a chain of branches
+		int code = turned ? -5 : 1;
+		code = far ? -4 : code;
+		code = invalid ? -3 : code;
+		block[k].result = (result[k] < 0) ? result[k] : code;
+		block[k].error = dot(referenceNormal, diff);
+		block[k].J[0] = referenceNormal.x;
+		block[k].J[1] = referenceNormal.y;
+		block[k].J[2] = referenceNormal.z;
+		block[k].J[3] = rotation.x;
+		block[k].J[4] = rotation.y;
+		block[k].J[5] = rotation.z;
+	}
+
+	// error and J are only read for tracked pixels
+	memcpy(output, block, sizeof(TrackData) * n);
+}
+
+KFUSION_SIMD_CLONES
+void trackKernel(TrackData* output, const PlanarPoints inVertex,
+		const PlanarPoints inNormal, uint2 inSize, const PlanarPoints refVertex,
+		const PlanarPoints refNormal, uint2 refSize, const Matrix4 Ttrack,
 		const Matrix4 view, const float dist_threshold,
 		const float normal_threshold) {
 	TICK();
-	uint2 pixel = make_uint2(0, 0);
-	unsigned int pixely, pixelx;
+	unsigned int pixely;
 #pragma omp parallel for \
-	    shared(output), private(pixel,pixelx,pixely)
+	    shared(output), private(pixely)
 	for (pixely = 0; pixely < inSize.y; pixely++) {
-		for (pixelx = 0; pixelx < inSize.x; pixelx++) {
-			pixel.x = pixelx;
-			pixel.y = pixely;
-
-			TrackData & row = output[pixel.x + pixel.y * refSize.x];
-
-			if (inNormal[pixel.x + pixel.y * inSize.x].x == KFUSION_INVALID) {
-				row.result = -1;
-				continue;
-			}
-
-			const float3 projectedVertex = Ttrack
-					* inVertex[pixel.x + pixel.y * inSize.x];
-			const float3 projectedPos = view * projectedVertex;
-			const float2 projPixel = make_float2(
-					projectedPos.x / projectedPos.z + 0.5f,
-					projectedPos.y / projectedPos.z + 0.5f);
-			if (projPixel.x < 0 || projPixel.x > refSize.x - 1
-					|| projPixel.y < 0 || projPixel.y > refSize.y - 1) {
-				row.result = -2;
-				continue;
-			}
+		for (uint x0 = 0; x0 < inSize.x; x0 += track_block) {
+			const uint n = std::min((uint) track_block, inSize.x - x0);
+			trackPixels<false>(output + x0 + pixely * inSize.x, NULL, x0 + pixely * inSize.x,
+					n, inVertex, inNormal, refVertex, refNormal, refSize, Ttrack, view,
+					dist_threshold, normal_threshold);
+		}
+	}
+	TOCK("trackKernel", inSize.x * inSize.y);
+}
 
-			const uint2 refPixel = make_uint2(projPixel.x, projPixel.y);
-			const float3 referenceNormal = refNormal[refPixel.x
-					+ refPixel.y * refSize.x];
+KFUSION_SIMD_CLONES
+void trackSamplesKernel(TrackData* output, const uint* samples, uint count,
+		const PlanarPoints inVertex, const PlanarPoints inNormal,
+		const PlanarPoints refVertex, const PlanarPoints refNormal, uint2 refSize,
+		const Matrix4 Ttrack, const Matrix4 view, const float dist_threshold,
+		const float normal_threshold) {
+	TICK();
+	int b;
+#pragma omp parallel for \
+	    shared(output), private(b)
+	for (b = 0; b < (int) count; b += track_block) {
+		const uint n = std::min((uint) track_block, count - b);
+		trackPixels<true>(output + b, samples + b, 0, n, inVertex, inNormal, refVertex,
+				refNormal, refSize, Ttrack, view, dist_threshold, normal_threshold);
+	}
+	// the rest of the last row the reduction reads
+	const uint2 size = samplesSize(count);
+	for (uint i = count; i < size.x * size.y; i++)
+		output[i].result = -1;
+	TOCK("trackSamplesKernel", count);
+}
 
-			if (referenceNormal.x == KFUSION_INVALID) {
-				row.result = -3;
-				continue;
-			}
+// Sampled results back in the image renderTrackKernel shows, the pixels left out as having no input
+void scatterSamplesKernel(TrackData* output, const TrackData* sampled, const uint* samples,
+		uint count, uint2 inSize, uint2 outSize) {
+	TICK();
+	for (uint y = 0; y < inSize.y; y++)
+		for (uint x = 0; x < inSize.x; x++)
+			output[x + y * outSize.x].result = -1;
+	for (uint i = 0; i < count; i++)
+		output[samples[i] % inSize.x + samples[i] / inSize.x * outSize.x] = sampled[i];
+	TOCK("scatterSamplesKernel", inSize.x * inSize.y);
+}
 
-			const float3 diff = refVertex[refPixel.x + refPixel.y * refSize.x]
-					- projectedVertex;
-			const float3 projectedNormal = rotate(Ttrack,
-					inNormal[pixel.x + pixel.y * inSize.x]);
+// Up to target valid pixels of a level for ICP, in image order, and how many valid pixels there were;
+// 0 when there are fewer and the level is tracked whole.
+// Stride keeps a regular grid, normal spreads the samples evenly over the normal directions, gradient keeps
+// the pixel where the depth changes fastest in each cell of that grid.
+uint selectSamplesKernel(uint* samples, uint & validCount, const PlanarPoints normal,
+		const float* depth, uint2 size, IcpSampling policy, uint target) {
+	TICK();
+	std::vector<uint> valid;
+	valid.reserve(size.x * size.y);
+	for (uint i = 0; i < size.x * size.y; i++)
+		if (normal.x[i] != KFUSION_INVALID)
+			valid.push_back(i);
+	validCount = valid.size();
+	uint count = 0;
+	if (valid.size() <= target) {
+		TOCK("selectSamplesKernel", size.x * size.y);
+		return 0;
+	}
 
-			if (length(diff) > dist_threshold) {
-				row.result = -4;
-				continue;
-			}
-			if (dot(projectedNormal, referenceNormal) < normal_threshold) {
-				row.result = -5;
-				continue;
-			}
-			row.result = 1;
-			row.error = dot(referenceNormal, diff);
-			((float3 *) row.J)[0] = referenceNormal;
-			((float3 *) row.J)[1] = cross(projectedVertex, referenceNormal);
+	switch (policy) {
+	case ICP_SAMPLING_STRIDE: {
+		const uint stride = std::max(1, (int) std::sqrt((float) valid.size() / target));
+		for (size_t v = 0; v < valid.size(); v++) {
+			const uint x = valid[v] % size.x, y = valid[v] / size.x;
+			if (x % stride == 0 && y % stride == 0)
+				samples[count++] = valid[v];
 		}
+		break;
 	}
-	TOCK("trackKernel", inSize.x * inSize.y);
+	case ICP_SAMPLING_NORMAL: {
+		// 4 bins per normal component, each bin gets an equal share or all it holds
+		const int bins = 4;
+		std::vector<std::vector<uint> > buckets(bins * bins * bins);
+		for (size_t v = 0; v < valid.size(); v++) {
+			const float3 n = normal.get(valid[v]);
+			const int bx = std::min(bins - 1, (int) ((n.x + 1) * 0.5f * bins));
+			const int by = std::min(bins - 1, (int) ((n.y + 1) * 0.5f * bins));
+			const int bz = std::min(bins - 1, (int) ((n.z + 1) * 0.5f * bins));
+			buckets[bx + bins * (by + bins * bz)].push_back(valid[v]);
+		}
+		// smallest bins first, so that what they cannot fill goes to the larger ones
+		std::vector<std::pair<size_t, size_t> > order;
+		for (size_t b = 0; b < buckets.size(); b++)
+			if (!buckets[b].empty())
+				order.push_back(std::make_pair(buckets[b].size(), b));
+		std::sort(order.begin(), order.end());
+		uint left = target;
+		for (size_t o = 0; o < order.size(); o++) {
+			const std::vector<uint> & bucket = buckets[order[o].second];
+			const size_t share = std::min(bucket.size(), (size_t) (left / (order.size() - o)));
+			for (size_t j = 0; j < share; j++)
+				samples[count++] = bucket[j * bucket.size() / share];
+			left -= share;
+		}
+		std::sort(samples, samples + count);
+		break;
+	}
+	case ICP_SAMPLING_GRADIENT: {
+		// the steepest pixel of each cell of the stride grid, so that the samples still cover the
+		// image; steps larger than the ICP distance threshold are silhouettes rather than surface
+		const uint stride = std::max(1, (int) std::sqrt((float) valid.size() / target));
+		for (uint y0 = 0; y0 < size.y; y0 += stride)
+			for (uint x0 = 0; x0 < size.x; x0 += stride) {
+				float steepest = -1.0f;
+				uint best = 0;
+				for (uint y = std::max(y0, 1u); y < std::min(y0 + stride, size.y - 1); y++)
+					for (uint x = std::max(x0, 1u); x < std::min(x0 + stride, size.x - 1); x++) {
+						const uint i = x + y * size.x;
+						if (normal.x[i] == KFUSION_INVALID)
+							continue;
+						const float dx = fabsf(depth[i + 1] - depth[i - 1]);
+						const float dy = fabsf(depth[i + size.x] - depth[i - size.x]);
+						if (std::max(dx, dy) < dist_threshold && dx + dy > steepest) {
+							steepest = dx + dy;
+							best = i;
+						}
+					}
+				if (steepest >= 0)
+					samples[count++] = best;
+			}
+		std::sort(samples, samples + count);
+		break;
+	}
+	default:
+		break;
+	}
+	TOCK("selectSamplesKernel", size.x * size.y);
+	return count;
 }
 
-void mm2metersKernel(float * out, uint2 outSize, const ushort * in,
-		uint2 inSize) {
-	TICK();
+// Subsampling ratio from the input depth to the computation size
+inline int depthRatio(uint2 outSize, uint2 inSize) {
 	// Check for unsupported conditions
 	if ((inSize.x < outSize.x) || (inSize.y < outSize.y)) {
 		std::cerr << "Invalid ratio." << std::endl;
@@ -575,8 +1173,13 @@ void mm2metersKernel(float * out, uint2 outSize, const ushort * in,
 		std::cerr << "Invalid ratio." << std::endl;
 		exit(1);
 	}
+	return inSize.x / outSize.x;
+}
 
-	int ratio = inSize.x / outSize.x;
+void mm2metersKernel(float * out, uint2 outSize, const ushort * in,
+		uint2 inSize) {
+	TICK();
+	int ratio = depthRatio(outSize, inSize);
 	unsigned int y;
 #pragma omp parallel for \
         shared(out), private(y)
@@ -588,6 +1191,37 @@ void mm2metersKernel(float * out, uint2 outSize, const ushort * in,
 	TOCK("mm2metersKernel", outSize.x * outSize.y);
 }
 
+// Row y of the half sampled image
+inline void halfSampleRow(float* out, const float* in, uint2 inSize,
+		const float e_d, const int r, uint y) {
+	uint2 outSize = make_uint2(inSize.x / 2, inSize.y / 2);
+	for (unsigned int x = 0; x < outSize.x; x++) {
+		uint2 pixel = make_uint2(x, y);
+		const uint2 centerPixel = 2 * pixel;
+
+		float sum = 0.0f;
+		float t = 0.0f;
+		const float center = in[centerPixel.x
+				+ centerPixel.y * inSize.x];
+		for (int i = -r + 1; i <= r; ++i) {
+			for (int j = -r + 1; j <= r; ++j) {
+				uint2 cur = make_uint2(
+						clamp(
+								make_int2(centerPixel.x + j,
+										centerPixel.y + i), make_int2(0),
+								make_int2(2 * outSize.x - 1,
+										2 * outSize.y - 1)));
+				float current = in[cur.x + cur.y * inSize.x];
+				if (fabsf(current - center) < e_d) {
+					sum += 1.0f;
+					t += current;
+				}
+			}
+		}
+		out[pixel.x + pixel.y * outSize.x] = t / sum;
+	}
+}
+
 void halfSampleRobustImageKernel(float* out, const float* in, uint2 inSize,
 		const float e_d, const int r) {
 	TICK();
@@ -595,76 +1229,223 @@ void halfSampleRobustImageKernel(float* out, const float* in, uint2 inSize,
 	unsigned int y;
 #pragma omp parallel for \
         shared(out), private(y)
-	for (y = 0; y < outSize.y; y++) {
+	for (y = 0; y < outSize.y; y++)
+		halfSampleRow(out, in, inSize, e_d, r, y);
+	TOCK("halfSampleRobustImageKernel", outSize.x * outSize.y);
+}
+
+// Next level of the raycast reference: each 2x2 block averaged over its valid points within e_d of
+// the first one, so that surfaces are not blended across depth discontinuities
+void halfSamplePointsKernel(PlanarPoints outVertex, PlanarPoints outNormal,
+		const PlanarPoints inVertex, const PlanarPoints inNormal, uint2 inSize, const float e_d) {
+	TICK();
+	uint2 outSize = make_uint2(inSize.x / 2, inSize.y / 2);
+	unsigned int y;
+#pragma omp parallel for \
+        shared(outVertex, outNormal), private(y)
+	for (y = 0; y < outSize.y; y++)
 		for (unsigned int x = 0; x < outSize.x; x++) {
-			uint2 pixel = make_uint2(x, y);
-			const uint2 centerPixel = 2 * pixel;
-
-			float sum = 0.0f;
-			float t = 0.0f;
-			const float center = in[centerPixel.x
-					+ centerPixel.y * inSize.x];
-			for (int i = -r + 1; i <= r; ++i) {
-				for (int j = -r + 1; j <= r; ++j) {
-					uint2 cur = make_uint2(
-							clamp(
-									make_int2(centerPixel.x + j,
-											centerPixel.y + i), make_int2(0),
-									make_int2(2 * outSize.x - 1,
-											2 * outSize.y - 1)));
-					float current = in[cur.x + cur.y * inSize.x];
-					if (fabsf(current - center) < e_d) {
-						sum += 1.0f;
-						t += current;
-					}
+			float3 first = make_float3(0);
+			float3 vertexSum = make_float3(0);
+			float3 normalSum = make_float3(0);
+			int count = 0;
+			for (int i = 0; i < 4; i++) {
+				const uint pixel = (2 * x + (i & 1)) + (2 * y + (i >> 1)) * inSize.x;
+				if (inNormal.x[pixel] == KFUSION_INVALID)
+					continue;
+				const float3 v = inVertex.get(pixel);
+				if (count == 0)
+					first = v;
+				else if (length(v - first) > e_d)
+					continue;
+				vertexSum += v;
+				normalSum += inNormal.get(pixel);
+				count++;
+			}
+			const uint pixel = x + y * outSize.x;
+			if (count == 0 || length(normalSum) == 0) {
+				outVertex.set(pixel, make_float3(0));
+				outNormal.set(pixel, make_float3(KFUSION_INVALID, 0, 0));
+			} else {
+				outVertex.set(pixel, vertexSum / (float) count);
+				outNormal.set(pixel, normalize(normalSum));
+			}
+		}
+	TOCK("halfSamplePointsKernel", outSize.x * outSize.y);
+}
+
+// Rows of the computation size image converted per band: a multiple of the coarsest level's
+// subsampling, so a band's pyramid rows only read the finer rows of the same band
+static const uint preprocess_band = 16;
+
+// mm2metersKernel, bilateralFilterKernel and the halfSampleRobustImageKernel pyramid in one pass.
+// Each band converts its rows and the filter's halo into a tile, the edge rows repeated beyond the
+// image, filters it into pyramid[0] and half samples the rows it just wrote into the next levels.
+void preprocessKernel(float * depth, float ** pyramid, uint levels, uint2 size,
+		const ushort * in, uint2 inSize, const float * gaussian, float e_d) {
+	TICK();
+	const int ratio = depthRatio(size, inSize);
+	const uint band = std::max(preprocess_band, 1u << (levels - 1));
+	const int bands = (size.y + band - 1) / band;
+	const float e_d_squared_2 = e_d * e_d * 2;
+	const uint2 tileSize = make_uint2(size.x, band + 2 * radius);
+#pragma omp parallel
+	{
+		std::vector<float> tile(tileSize.x * tileSize.y);
+		int b;
+#pragma omp for private(b)
+		for (b = 0; b < bands; b++) {
+			const uint y0 = b * band;
+			const uint y1 = std::min(y0 + band, size.y);
+			for (uint ty = 0; ty < y1 - y0 + 2 * radius; ty++) {
+				const int row = (int) (y0 + ty) - radius;
+				const ushort * inRow = in + inSize.x * clamp(row, 0, (int) size.y - 1) * ratio;
+				float * tileRow = &tile[ty * tileSize.x];
+				for (uint x = 0; x < size.x; x++)
+					tileRow[x] = inRow[x * ratio] / 1000.0f;
+				if (row >= (int) y0 && row < (int) y1)
+					memcpy(depth + row * size.x, tileRow, sizeof(float) * size.x);
+			}
+
+			for (uint y = y0; y < y1; y++) {
+				float * outRow = pyramid[0] + y * size.x;
+				const uint ty = y - y0 + radius;
+				if (size.x <= 2 * radius) {
+					for (uint x = 0; x < size.x; x++)
+						outRow[x] = bilateralPixel(&tile[0], tileSize, gaussian, e_d_squared_2, x, ty, radius);
+					continue;
 				}
+				for (uint x = 0; x < (uint) radius; x++) {
+					outRow[x] = bilateralPixel(&tile[0], tileSize, gaussian, e_d_squared_2, x, ty, radius);
+					outRow[size.x - 1 - x] = bilateralPixel(&tile[0], tileSize, gaussian, e_d_squared_2,
+							size.x - 1 - x, ty, radius);
+				}
+				bilateralFilterInterior<radius>(outRow, &tile[0], tileSize, gaussian,
+						1.0f / e_d_squared_2, ty);
+			}
+
+			for (uint level = 1; level < levels; level++) {
+				const uint2 inLevel = make_uint2(size.x >> (level - 1), size.y >> (level - 1));
+				const uint end = std::min(y1 >> level, inLevel.y / 2);
+				for (uint y = y0 >> level; y < end; y++)
+					halfSampleRow(pyramid[level], pyramid[level - 1], inLevel, e_d * 3, 1, y);
 			}
-			out[pixel.x + pixel.y * outSize.x] = t / sum;
 		}
 	}
-	TOCK("halfSampleRobustImageKernel", outSize.x * outSize.y);
+	TOCK("preprocessKernel", size.x * size.y);
+}
+
+// Shift the volume by whole voxels along one axis. The slices leaving the volume are written to
+// evicted when they hold data, then reset: their storage becomes the slices entering at the other end.
+// Evicted record: int axis, int3 world voxel of the slice corner, uint2 slice size, then per voxel
+// a short TSDF and a short weight, iterating the lower remaining axis first.
+void rollVolumeKernel(Volume & volume, int axis, int voxels,
+		std::ostream * evicted) {
+	TICK();
+	uint * size = &volume.size.x;
+	int * origin = &volume.origin.x;
+	uint * shift = &volume.shift.x;
+	const int u = (axis == 0) ? 1 : 0;
+	const int v = (axis == 2) ? 1 : 2;
+	const uint2 sliceSize = make_uint2(size[u], size[v]);
+	short * slice = (short *) malloc(2 * sizeof(short) * sliceSize.x * sliceSize.y);
+
+	const int count = std::min(abs(voxels), (int) size[axis]);
+	for (int s = 0; s < count; s++) {
+		uint3 pos;
+		uint * p = &pos.x;
+		p[axis] = (voxels > 0) ? s : size[axis] - 1 - s;
+		bool touched = false;
+		for (p[v] = 0; p[v] < size[v]; p[v]++)
+			for (p[u] = 0; p[u] < size[u]; p[u]++) {
+				const size_t i = volume.index(pos.x, pos.y, pos.z);
+				const uint j = 2 * (p[u] + p[v] * sliceSize.x);
+				slice[j] = Volume::format::toShort(volume.data[i]);
+				slice[j + 1] = volume.weight[i];
+				touched = touched || (volume.weight[i] > 0);
+				volume.set(pos, make_float2(1.0f, 0.0f));
+			}
+		if (touched && evicted) {
+			int3 sliceCorner = volume.origin;
+			(&sliceCorner.x)[axis] += p[axis];
+			evicted->write((char *) &axis, sizeof(int));
+			evicted->write((char *) &sliceCorner, sizeof(int3));
+			evicted->write((char *) &sliceSize, sizeof(uint2));
+			evicted->write((char *) slice, 2 * sizeof(short) * sliceSize.x * sliceSize.y);
+		}
+	}
+	free(slice);
+
+	origin[axis] += voxels;
+	shift[axis] = ((origin[axis] % (int) size[axis]) + size[axis]) % size[axis];
+	TOCK("rollVolumeKernel", count * sliceSize.x * sliceSize.y);
 }
 
 void integrateKernel(Volume vol, const float* depth, uint2 depthSize,
 		const Matrix4 invTrack, const Matrix4 K, const float mu,
-		const float maxweight) {
+		const float maxweight, char * dirtyBricks) {
 	TICK();
-	const float3 delta = rotate(invTrack,
-			make_float3(0, 0, vol.dim.z / vol.size.z));
-	const float3 cameraDelta = rotate(K, delta);
-	unsigned int y;
+	integrateSlab(vol, depth, depthSize, invTrack, K, mu, maxweight, 0, vol.size.y, dirtyBricks);
+	TOCK("integrateKernel", vol.size.x * vol.size.y);
+}
+// Pixel-driven integration: each valid depth pixel marks the bricks its ray crosses within the truncation
+// band, then only the voxels of those bricks get the voxel-driven update. Marks are atomic writes of the same
+// value and every voxel is still updated once from the pixel it projects to, so the result does not depend
+// on the threads.
+void integrateBandKernel(Volume vol, const float* depth, uint2 depthSize,
+		const Matrix4 pose, const Matrix4 K, const float mu,
+		const float maxweight, char * band, char * dirtyBricks) {
+	TICK();
+	const uint3 bricks = vol.bricks();
+	const int count = bricks.x * bricks.y * bricks.z;
+	memset(band, 0, count);
+	const Matrix4 invK = inverse(K);
+	const float3 scale = make_float3(vol.size) / vol.dim;
+	const float step = 1.0f / fmaxf(scale.x, fmaxf(scale.y, scale.z));
+	const float3 origin = get_translation(pose);
+	int y;
 #pragma omp parallel for \
-        shared(vol), private(y)
-	for (y = 0; y < vol.size.y; y++)
-		for (unsigned int x = 0; x < vol.size.x; x++) {
-
-			uint3 pix = make_uint3(x, y, 0); //pix.x = x;pix.y = y;
-			float3 pos = invTrack * vol.pos(pix);
-			float3 cameraX = K * pos;
-
-			for (pix.z = 0; pix.z < vol.size.z; ++pix.z, pos += delta, cameraX += cameraDelta) {
-				if (pos.z < 0.0001f) continue; // some near plane constraint
-				const float2 pixel = make_float2(cameraX.x / cameraX.z + 0.5f, cameraX.y / cameraX.z + 0.5f);
-
-				if (pixel.x < 0 || pixel.x > depthSize.x - 1 || pixel.y < 0 || pixel.y > depthSize.y - 1) continue;
-				const uint2 px = make_uint2(pixel.x, pixel.y);
-
-				if (depth[px.x + px.y * depthSize.x] == 0) continue;
-				const float diff = (depth[px.x + px.y * depthSize.x] - cameraX.z)
-								* std::sqrt(1 + sq(pos.x / pos.z) + sq(pos.y / pos.z));
-
-				if (diff > -mu) {
-					const float sdf = fminf(1.f, diff / mu);
-					float2 data = vol[pix];
-					data.x = clamp((data.y * data.x + sdf) / (data.y + 1), -1.f,
-							1.f);
-					data.y = fminf(data.y + 1, maxweight);
-					vol.set(pix, data);
-				}
+        shared(band), private(y)
+	for (y = 0; y < (int) depthSize.y; y++)
+		for (uint x = 0; x < depthSize.x; x++) {
+			const float d = depth[x + y * depthSize.x];
+			if (d == 0)
+				continue;
+			// ray through the pixel centre, in depth units along the optical axis
+			const float3 ray = rotate(invK, make_float3(x, y, 1));
+			const float3 direction = rotate(pose, ray);
+			const float band_depth = mu / length(ray);
+			for (float z = d - band_depth; z <= d + band_depth; z += step / length(ray)) {
+				const float3 p = (origin + direction * z) * scale - make_float3(vol.origin);
+				if (p.x < 0 || p.y < 0 || p.z < 0 || p.x >= vol.size.x || p.y >= vol.size.y
+						|| p.z >= vol.size.z)
+					continue;
+				const uint b = (uint) p.x / brick_size + ((uint) p.y / brick_size) * bricks.x
+						+ ((uint) p.z / brick_size) * bricks.x * bricks.y;
+#pragma omp atomic write
+				band[b] = 1;
 			}
 		}
-	TOCK("integrateKernel", vol.size.x * vol.size.y);
+
+	ColumnIntegrator<Volume::format> column(vol, depth, depthSize, inverse(pose), K, mu,
+			maxweight, dirtyBricks);
+	int b;
+#pragma omp parallel for \
+        shared(column), private(b) schedule(dynamic)
+	for (b = 0; b < count; b++) {
+		if (!band[b])
+			continue;
+		const uint3 first = make_uint3((b % bricks.x) * brick_size,
+				((b / bricks.x) % bricks.y) * brick_size, (b / (bricks.x * bricks.y)) * brick_size);
+		const uint3 last = make_uint3(std::min(first.x + brick_size, vol.size.x),
+				std::min(first.y + brick_size, vol.size.y), std::min(first.z + brick_size, vol.size.z));
+		for (uint y = first.y; y < last.y; y++)
+			for (uint x = first.x; x < last.x; x++)
+				column(x, y, first.z, last.z);
+	}
+	TOCK("integrateBandKernel", depthSize.x * depthSize.y);
 }
+
 float4 raycast(const Volume volume, const uint2 pos, const Matrix4 view,
 		const float nearPlane, const float farPlane, const float step,
 		const float largestep) {
@@ -676,8 +1457,8 @@ float4 raycast(const Volume volume, const uint2 pos, const Matrix4 view,
 	// http://www.siggraph.org/education/materials/HyperGraph/raytrace/rtinter3.htm
 	// compute intersection of ray with all six bbox planes
 	const float3 invR = make_float3(1.0f) / direction;
-	const float3 tbot = -1 * invR * origin;
-	const float3 ttop = invR * (volume.dim - origin);
+	const float3 tbot = invR * (volume.corner() - origin);
+	const float3 ttop = invR * (volume.corner() + volume.dim - origin);
 
 	// re-order intersections to find smallest and largest on each axis
 	const float3 tmin = fminf(ttop, tbot);
@@ -717,7 +1498,7 @@ float4 raycast(const Volume volume, const uint2 pos, const Matrix4 view,
 	return make_float4(0);
 
 }
-void raycastKernel(float3* vertex, float3* normal, uint2 inputSize,
+void raycastKernel(PlanarPoints vertex, PlanarPoints normal, uint2 inputSize,
 		const Volume integration, const Matrix4 view, const float nearPlane,
 		const float farPlane, const float step, const float largestep) {
 	TICK();
@@ -732,19 +1513,19 @@ void raycastKernel(float3* vertex, float3* normal, uint2 inputSize,
 			const float4 hit = raycast(integration, pos, view, nearPlane,
 					farPlane, step, largestep);
 			if (hit.w > 0.0) {
-				vertex[pos.x + pos.y * inputSize.x] = make_float3(hit);
+				vertex.set(pos.x + pos.y * inputSize.x, make_float3(hit));
 				float3 surfNorm = integration.grad(make_float3(hit));
 				if (length(surfNorm) == 0) {
 					//normal[pos] = normalize(surfNorm); // APN added
-					normal[pos.x + pos.y * inputSize.x].x = KFUSION_INVALID;
+					normal.x[pos.x + pos.y * inputSize.x] = KFUSION_INVALID;
 				} else {
-					normal[pos.x + pos.y * inputSize.x] = normalize(surfNorm);
+					normal.set(pos.x + pos.y * inputSize.x, normalize(surfNorm));
 				}
 			} else {
 				//std::cerr<< "RAYCAST MISS "<<  pos.x << " " << pos.y <<"  " << hit.w <<"\n";
-				vertex[pos.x + pos.y * inputSize.x] = make_float3(0);
-				normal[pos.x + pos.y * inputSize.x] = make_float3(KFUSION_INVALID, 0,
-						0);
+				vertex.set(pos.x + pos.y * inputSize.x, make_float3(0));
+				normal.set(pos.x + pos.y * inputSize.x, make_float3(KFUSION_INVALID, 0,
+						0));
 			}
 		}
 	TOCK("raycastKernel", inputSize.x * inputSize.y);
@@ -768,6 +1549,36 @@ bool updatePoseKernel(Matrix4 & pose, const float * output,
 	return res;
 }
 
+// Times the LDLT solve against the SVD on one ICP system and compares the poses they lead to
+void reportPoseSolver(const float * output, const Matrix4 & pose) {
+	TooN::Matrix<8, 32, const float, TooN::Reference::RowMajor> values(output);
+	const int runs = 10000;
+	TooN::Vector<6> fast, reference;
+	const bool factorised = solveLDLT(values[0].slice<1, 27>(), fast);
+	struct timespec start, middle, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < runs; i++)
+		fast = solve(values[0].slice<1, 27>());
+	clock_gettime(CLOCK_MONOTONIC, &middle);
+	for (int i = 0; i < runs; i++)
+		reference = solveSVD(values[0].slice<1, 27>());
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double maxError = 0, poseError = 0;
+	for (int i = 0; i < 6; i++)
+		maxError = std::max(maxError, (double) fabs(fast[i] - reference[i]));
+	const Matrix4 fastPose = toMatrix4(TooN::SE3<>(fast)) * pose;
+	const Matrix4 referencePose = toMatrix4(TooN::SE3<>(reference)) * pose;
+	for (int i = 0; i < 16; i++)
+		poseError = std::max(poseError,
+				(double) fabs((&fastPose.data[0].x)[i] - (&referencePose.data[0].x)[i]));
+	const double fastTime = (middle.tv_sec - start.tv_sec) + (middle.tv_nsec - start.tv_nsec) * 1e-9;
+	const double referenceTime = (end.tv_sec - middle.tv_sec) + (end.tv_nsec - middle.tv_nsec) * 1e-9;
+	std::cerr << "poseSolverReport ldlt " << factorised << " solveNs " << fastTime / runs * 1e9
+			<< " svdNs " << referenceTime / runs * 1e9 << " maxError " << maxError
+			<< " poseError " << poseError << std::endl;
+}
+
 bool checkPoseKernel(Matrix4 & pose, Matrix4 oldPose, const float * output,
 		uint2 imageSize, float track_threshold) {
 
@@ -908,9 +1719,14 @@ void renderVolumeKernel(uchar4* out, const uint2 depthSize, const Volume volume,
 
 bool Kfusion::preprocessing(const ushort * inputDepth, const uint2 inputSize) {
 
-	mm2metersKernel(floatDepth, computationSize, inputDepth, inputSize);
-	bilateralFilterKernel(ScaledDepth[0], floatDepth, computationSize, gaussian,
-			e_delta, radius);
+	preprocessKernel(floatDepth, ScaledDepth, iterations.size(), computationSize,
+			inputDepth, inputSize, gaussian, e_delta);
+
+	static bool reported = false;
+	if (print_kernel_timing && !reported) {
+		reportBilateralFilter(floatDepth, computationSize, gaussian, e_delta);
+		reported = true;
+	}
 
 	return true;
 }
@@ -921,46 +1737,86 @@ bool Kfusion::tracking(float4 k, float icp_threshold, uint tracking_rate,
 	if (frame % tracking_rate != 0)
 		return false;
 
-	// half sample the input depth maps into the pyramid levels
-	for (unsigned int i = 1; i < iterations.size(); ++i) {
-		halfSampleRobustImageKernel(ScaledDepth[i], ScaledDepth[i - 1],
-				make_uint2(computationSize.x / (int) pow(2, i - 1),
-						computationSize.y / (int) pow(2, i - 1)), e_delta * 3, 1);
-	}
+	// the pyramid levels were half sampled by preprocessKernel
 
 	// prepare the 3D information from the input depth maps
 	uint2 localimagesize = computationSize;
+	static bool layoutsReported = false;
+	if (print_kernel_timing && !layoutsReported) {
+		reportPointLayouts(ScaledDepth[0], computationSize, getInverseCameraMatrix(k));
+		layoutsReported = true;
+	}
 	for (unsigned int i = 0; i < iterations.size(); ++i) {
 		Matrix4 invK = getInverseCameraMatrix(k / float(1 << i));
-		depth2vertexKernel(inputVertex[i], ScaledDepth[i], localimagesize,
-				invK);
-		vertex2normalKernel(inputNormal[i], inputVertex[i], localimagesize);
+		depth2vertexNormalKernel(inputVertex[i], inputNormal[i], ScaledDepth[i],
+				localimagesize, invK);
+		if (icp_sampling != ICP_SAMPLING_ALL)
+			sampledCount[i] = selectSamplesKernel(sampledPixels[i], sampledValid[i],
+					inputNormal[i], ScaledDepth[i], localimagesize, icp_sampling, icp_samples);
 		localimagesize = make_uint2(localimagesize.x / 2, localimagesize.y / 2);
 	}
 
 	oldPose = pose;
-	const Matrix4 projectReference = getCameraMatrix(k) * inverse(raycastPose);
+	if (motion_damping > 0)
+		pose = predictPose(motion_previous, oldPose, motion_damping);
+	motion_previous = oldPose;
+	const Matrix4 inverseRaycastPose = inverse(raycastPose);
 
+	icp_budget.begin();
 	for (int level = iterations.size() - 1; level >= 0; --level) {
 		uint2 localimagesize = make_uint2(
 				computationSize.x / (int) pow(2, level),
 				computationSize.y / (int) pow(2, level));
-		for (int i = 0; i < iterations[level]; ++i) {
-
-			trackKernel(trackingResult, inputVertex[level], inputNormal[level],
-					localimagesize, vertex, normal, computationSize, pose,
-					projectReference, dist_threshold, normal_threshold);
+		// each level against the reference of its own size, or all of them against the raycast
+		const int reference = std::max(reference_pyramid ? level : 0, (int) raycast_last);
+		const uint2 referenceSize = make_uint2(computationSize.x >> reference,
+				computationSize.y >> reference);
+		const Matrix4 projectReference = getCameraMatrix(k / float(1 << reference))
+				* inverseRaycastPose;
+		const uint samples = sampledCount[level];
+		for (int i = 0; i < icp_budget.budget[level]; ++i) {
+
+			if (samples > 0) {
+				trackSamplesKernel(sampledResult, sampledPixels[level], samples,
+						inputVertex[level], inputNormal[level], referenceVertex[reference],
+						referenceNormal[reference], referenceSize, pose, projectReference,
+						dist_threshold, normal_threshold);
+				reduceKernel(reductionoutput, sampledResult, samplesSize(samples),
+						samplesSize(samples));
+			} else {
+				trackKernel(trackingResult, inputVertex[level], inputNormal[level],
+						localimagesize, referenceVertex[reference], referenceNormal[reference],
+						referenceSize, pose, projectReference, dist_threshold, normal_threshold);
+				reduceKernel(reductionoutput, trackingResult, localimagesize,
+						localimagesize);
+			}
 
-			reduceKernel(reductionoutput, trackingResult, computationSize,
-					localimagesize);
+			static bool reported = false;
+			if (print_kernel_timing && !reported && reductionoutput[28] > 0) {
+				reportPoseSolver(reductionoutput, pose);
+				reported = true;
+			}
 
-			if (updatePoseKernel(pose, reductionoutput, icp_threshold))
+			const bool converged = updatePoseKernel(pose, reductionoutput, icp_threshold);
+			icp_budget.record(level, reductionoutput, converged);
+			if (converged)
 				break;
 
 		}
+		// the finest level covers what the others tracked
+		if (samples > 0 && level == 0)
+			scatterSamplesKernel(trackingResult, sampledResult, sampledPixels[level], samples,
+					localimagesize, computationSize);
 	}
-	return checkPoseKernel(pose, oldPose, reductionoutput, computationSize,
-			track_threshold);
+	const bool tracked = checkPoseKernel(pose, oldPose, reductionoutput,
+			trackedSize(computationSize), track_threshold);
+
+	if (motion_damping >= 0 || adaptive_icp)
+		icp_budget.print(*logstreamCustom, frame, tracked);
+	if (adaptive_icp && tracked)
+		icp_budget.adapt();
+	raycast_refine = !tracked;
+	return tracked;
 
 }
 
@@ -970,9 +1826,29 @@ bool Kfusion::raycasting(float4 k, float mu, uint frame) {
 
 	if (frame > 2) {
 		raycastPose = pose;
-		raycastKernel(vertex, normal, computationSize, volume,
-				raycastPose * getInverseCameraMatrix(k), nearPlane, farPlane,
-				step, 0.75f * mu);
+		raycast_last = raycast_refine ? 0 : raycast_level;
+		raycastKernel(referenceVertex[raycast_last], referenceNormal[raycast_last],
+				make_uint2(computationSize.x >> raycast_last, computationSize.y >> raycast_last),
+				volume, raycastPose * getInverseCameraMatrix(k / float(1 << raycast_last)),
+				nearPlane, farPlane, step, 0.75f * mu);
+		if (raycast_level > 0)
+			*logstreamCustom << "raycast\t" << frame << "\t" << raycast_last << std::endl;
+		if (reference_pyramid)
+			for (unsigned int i = raycast_last + 1; i < iterations.size(); ++i)
+				halfSamplePointsKernel(referenceVertex[i], referenceNormal[i],
+						referenceVertex[i - 1], referenceNormal[i - 1],
+						make_uint2(computationSize.x >> (i - 1), computationSize.y >> (i - 1)),
+						dist_threshold);
+	}
+
+	// paging cost of a file-backed volume, over the frame ending with this raycast
+	if (volume.mapped) {
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		*logstreamCustom << "page-faults\t" << frame << "\t"
+				<< usage.ru_minflt - frame_usage.ru_minflt << "\t"
+				<< usage.ru_majflt - frame_usage.ru_majflt << std::endl;
+		frame_usage = usage;
 	}
 
 	return doRaycast;
@@ -983,11 +1859,34 @@ bool Kfusion::integration(float4 k, uint integration_rate, float mu,
 		uint frame) {
 
 	bool doIntegrate = checkPoseKernel(pose, oldPose, reductionoutput,
-			computationSize, track_threshold);
+			trackedSize(computationSize), track_threshold);
 
 	if ((doIntegrate && ((frame % integration_rate) == 0)) || (frame <= 3)) {
-		integrateKernel(volume, floatDepth, computationSize, inverse(pose),
-				getCameraMatrix(k), mu, maxweight);
+		if (rolling_threshold > 0) {
+			const float3 drift = get_translation(pose)
+					- (volume.corner() + rolling_anchor);
+			for (int axis = 0; axis < 3; axis++) {
+				const float d = (&drift.x)[axis];
+				const float voxelSize = (&volume.dim.x)[axis] / (&volume.size.x)[axis];
+				if (fabsf(d) > rolling_threshold) {
+					rollVolumeKernel(volume, axis, (int) roundf(d / voxelSize),
+							rolling_evicted.is_open() ? &rolling_evicted : NULL);
+					// every brick now holds other world voxels
+					if (dirty_bricks) {
+						const uint3 bricks = volume.bricks();
+						memset(dirty_bricks, 1, bricks.x * bricks.y * bricks.z);
+					}
+				}
+			}
+		}
+		if (band_integration)
+			integrateBandKernel(volume, floatDepth, computationSize, pose,
+					getCameraMatrix(k), mu, maxweight, band_bricks, dirty_bricks);
+		else
+			integrateKernel(volume, floatDepth, computationSize, inverse(pose),
+					getCameraMatrix(k), mu, maxweight, dirty_bricks);
+		if (live_mesher)
+			live_mesher->submit(volume, dirty_bricks);
 		doIntegrate = true;
 	} else {
 		doIntegrate = false;
@@ -1013,16 +1912,70 @@ void Kfusion::dumpVolume(const char *filename) {
 		exit(1);
 	}
 
-	// Dump on file without the y component of the short2 variable
-	for (unsigned int i = 0; i < volume.size.x * volume.size.y * volume.size.z;
-			i++) {
-		fDumpFile.write((char *) (volume.data + i), sizeof(short));
-	}
+	// Dump on file the TSDF array only, as shorts whatever the voxel format, in logical voxel order
+	const size_t voxels = (size_t) volume.size.x * volume.size.y * volume.size.z;
+	short * dump = (short *) malloc(voxels * sizeof(short));
+	size_t i = 0;
+	for (unsigned int z = 0; z < volume.size.z; z++)
+		for (unsigned int y = 0; y < volume.size.y; y++)
+			for (unsigned int x = 0; x < volume.size.x; x++)
+				dump[i++] = Volume::format::toShort(volume.data[volume.index(x, y, z)]);
+	fDumpFile.write((char *) dump, voxels * sizeof(short));
+	free(dump);
 
 	fDumpFile.close();
 
 }
 
+void Kfusion::dumpMesh(const char *filename) {
+
+	if (filename == NULL) {
+		return;
+	}
+
+	std::vector<float3> vertices;
+	std::vector<uint3> triangles;
+	TICK();
+	marchingCubes(volume, vertices, triangles);
+	TOCK("marchingCubesKernel", volume.size.x * volume.size.y * volume.size.z);
+
+	std::cout << "Dumping a mesh of " << vertices.size() << " vertices and "
+			<< triangles.size() << " triangles on file: " << filename << std::endl;
+	writePLY(filename, vertices, triangles);
+
+}
+
+void Kfusion::saveCheckpoint(const char *filename, uint frame) {
+	if (filename == NULL) {
+		return;
+	}
+	writeCheckpoint(filename, volume, pose, frame);
+}
+
+uint Kfusion::loadCheckpoint(const char *filename) {
+	const uint frame = readCheckpoint(filename, volume, pose);
+	oldPose = pose;
+	raycastPose = pose;
+	motion_previous = pose;
+	if (dirty_bricks) {
+		const uint3 bricks = volume.bricks();
+		memset(dirty_bricks, 1, bricks.x * bricks.y * bricks.z);
+	}
+	return frame;
+}
+
+uint Kfusion::meshDelta(uint since, std::vector<uint> & bricks,
+		std::vector<BrickMesh> & meshes, bool wait) {
+	if (live_mesher == NULL) {
+		bricks.clear();
+		meshes.clear();
+		return since;
+	}
+	if (wait)
+		live_mesher->flush();
+	return live_mesher->store.delta(since, bricks, meshes);
+}
+
 void Kfusion::renderVolume(uchar4 * out, uint2 outputSize, int frame,
 		int raycast_rendering_rate, float4 k, float largestep) {
 	if (frame % raycast_rendering_rate == 0)
@@ -1052,3 +2005,74 @@ void Kfusion::computeFrame(const ushort * inputDepth, const uint2 inputSize,
 void synchroniseDevices() {
 	// Nothing to do in the C++ implementation
 }
+
+void setZeroCopy(bool) {
+	// Nothing to do in the C++ implementation, buffers are already shared
+}
+
+void setDevicePlacement(const std::string & placement) {
+	if (placement != "")
+		std::cerr << "Device placement is ignored by the C++ implementation" << std::endl;
+}
+
+void setIntegrationSplit(float) {
+	// Nothing to do in the C++ implementation, integration already runs on the CPU
+}
+
+void setSpecialisedKernels(bool enable, float) {
+	if (enable)
+		std::cerr << "Specialised kernels are ignored by the C++ implementation" << std::endl;
+}
+
+void setRollingVolume(float threshold, const std::string & evictedFile) {
+	rolling_threshold = threshold;
+	if (evictedFile != "") {
+		rolling_evicted.open(evictedFile.c_str(), std::ios::out | std::ios::binary);
+		if (rolling_evicted.fail()) {
+			std::cerr << "Error opening file: " << evictedFile << std::endl;
+			exit(1);
+		}
+	}
+}
+
+void setLiveMesh(bool enable) {
+	live_mesh = enable;
+}
+
+void setVolumeFile(const std::string & filename) {
+	volume_file = filename;
+}
+
+void setBandIntegration(bool enable) {
+	band_integration = enable;
+}
+
+void setMotionModel(float damping) {
+	motion_damping = damping;
+}
+
+void setAdaptiveIcp(bool enable) {
+	adaptive_icp = enable;
+}
+
+void setRaycastRatio(uint ratio) {
+	raycast_level = 0;
+	while ((2u << raycast_level) <= ratio)
+		raycast_level++;
+}
+
+void setReferencePyramid(bool enable) {
+	reference_pyramid = enable;
+}
+
+void setIcpSampling(const std::string & policy, uint samples) {
+	if (policy == "stride")
+		icp_sampling = ICP_SAMPLING_STRIDE;
+	else if (policy == "normal")
+		icp_sampling = ICP_SAMPLING_NORMAL;
+	else if (policy == "gradient")
+		icp_sampling = ICP_SAMPLING_GRADIENT;
+	else
+		icp_sampling = ICP_SAMPLING_ALL;
+	icp_samples = samples;
+}
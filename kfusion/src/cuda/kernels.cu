@@ -950,3 +950,97 @@ void Kfusion::renderDepth(__device_builtin__uchar4 * out,
 void synchroniseDevices() {
 	cudaDeviceSynchronize();
 }
+
+////////////////////////// BACKEND OPTIONS //////////////////////
+// Options of the other backends, accepted so that the benchmark links and ignored here
+
+void setZeroCopy(bool enable) {
+	if (enable)
+		std::cerr << "Zero copy is ignored by the CUDA implementation" << std::endl;
+}
+
+void setDevicePlacement(const std::string & placement) {
+	if (placement != "")
+		std::cerr << "Device placement is ignored by the CUDA implementation" << std::endl;
+}
+
+void setIntegrationSplit(float deviceShare) {
+	if (deviceShare < 1.0f)
+		std::cerr << "Integration split is ignored by the CUDA implementation" << std::endl;
+}
+
+void setSpecialisedKernels(bool enable, float) {
+	if (enable)
+		std::cerr << "Specialised kernels are ignored by the CUDA implementation" << std::endl;
+}
+
+void setRollingVolume(float threshold, const std::string &) {
+	if (threshold > 0)
+		std::cerr << "Rolling volume is ignored by the CUDA implementation" << std::endl;
+}
+
+void Kfusion::dumpMesh(const char* filename) {
+	if (filename != NULL)
+		std::cerr << "Mesh extraction is ignored by the CUDA implementation" << std::endl;
+}
+
+void setLiveMesh(bool enable) {
+	if (enable)
+		std::cerr << "Live mesh is ignored by the CUDA implementation" << std::endl;
+}
+
+struct BrickMesh;
+
+uint Kfusion::meshDelta(uint since, std::vector<uint> & bricks,
+		std::vector<BrickMesh> & meshes, bool) {
+	// no live mesh in the CUDA implementation
+	bricks.clear();
+	meshes.clear();
+	return since;
+}
+
+void Kfusion::saveCheckpoint(const char* filename, uint) {
+	if (filename != NULL)
+		std::cerr << "Checkpoints are ignored by the CUDA implementation" << std::endl;
+}
+
+// starts from the first frame, the checkpoint being ignored
+uint Kfusion::loadCheckpoint(const char*) {
+	std::cerr << "Checkpoints are ignored by the CUDA implementation" << std::endl;
+	return 0;
+}
+
+void setVolumeFile(const std::string & filename) {
+	if (filename != "")
+		std::cerr << "File-backed volume is ignored by the CUDA implementation" << std::endl;
+}
+
+void setBandIntegration(bool enable) {
+	if (enable)
+		std::cerr << "Band integration is ignored by the CUDA implementation" << std::endl;
+}
+
+void setMotionModel(float damping) {
+	if (damping >= 0)
+		std::cerr << "Motion model is ignored by the CUDA implementation" << std::endl;
+}
+
+void setAdaptiveIcp(bool enable) {
+	if (enable)
+		std::cerr << "Adaptive ICP is ignored by the CUDA implementation" << std::endl;
+}
+
+void setIcpSampling(const std::string & policy, uint) {
+	if (policy != "all")
+		std::cerr << "ICP sampling is ignored by the CUDA implementation" << std::endl;
+}
+
+void setReferencePyramid(bool enable) {
+	if (enable)
+		std::cerr << "Reference pyramid is ignored by the CUDA implementation" << std::endl;
+}
+
+void setRaycastRatio(uint ratio) {
+	if (ratio != 1)
+		std::cerr << "Raycast ratio is ignored by the CUDA implementation" << std::endl;
+}
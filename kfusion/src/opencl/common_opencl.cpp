@@ -11,7 +11,13 @@
 #include "common_opencl.h"
 #include "AOCLUtils/aocl_utils.h"
 #include <sstream>
+#include <fstream>
 #include <cstring>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdlib.h>
 
 #define XSTR(x) #x
 #define STR(x) XSTR(x)
@@ -29,6 +35,177 @@ cl_program        *programs;
 // second index corresponds to the device in that platform
 cl_device_id     **device_lists;
 cl_command_queue **cmd_queues;
+cl_uint            num_ocl_devices = 0;
+ocl_device_ref    *ocl_devices = NULL;
+
+static void register_devices(cl_uint platform, cl_uint num_devices) {
+    char device_name[256];
+    ocl_devices = (ocl_device_ref *) realloc(ocl_devices, (num_ocl_devices + num_devices) * sizeof(ocl_device_ref));
+    for(cl_uint j=0; j<num_devices; j++){
+        ocl_devices[num_ocl_devices].platform = platform;
+        ocl_devices[num_ocl_devices].device = j;
+        clGetDeviceInfo(device_lists[platform][j], CL_DEVICE_NAME, 256, device_name, NULL);
+        printf("Device dev%d: %s (platform %d)\n", num_ocl_devices, device_name, platform);
+        num_ocl_devices++;
+    }
+}
+
+char              *opencl_source = NULL;
+double opencl_init_time = 0.0;
+double opencl_build_time = 0.0;
+unsigned int opencl_builds = 0;
+unsigned int opencl_cached_builds = 0;
+
+static double wall_time() {
+    struct timespec clockData;
+    clock_gettime(CLOCK_MONOTONIC, &clockData);
+    return (double) clockData.tv_sec + clockData.tv_nsec / 1000000000.0;
+}
+
+// 64-bit FNV-1a, enough to tell program builds apart
+static uint64_t fnv1a(const char * data, uint64_t hash = 14695981039346656037ULL) {
+    for (; *data; ++data) {
+        hash ^= (unsigned char) *data;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Creates a directory readable by its owner only, missing parents included
+static void make_private_dir(const std::string & path) {
+    for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1))
+        mkdir(path.substr(0, slash).c_str(), 0700);
+    mkdir(path.c_str(), 0700);
+}
+
+// Directory of the cached binaries, empty when caching is off. Binaries are loaded as code, so the
+// directory must be a real one that only this user can write to: $OPENCL_CACHE_PATH (or the build's
+// OPENCL_CACHE_PATH) overrides the default $XDG_CACHE_HOME/kfusion or ~/.cache/kfusion.
+static const std::string & cache_dir() {
+    static bool resolved = false;
+    static std::string dir;
+    if (resolved) return dir;
+    resolved = true;
+    if (getenv("OPENCL_CACHE_PATH")) {
+        dir = getenv("OPENCL_CACHE_PATH");
+#ifdef OPENCL_CACHE_PATH
+    } else if (strlen(OPENCL_CACHE_PATH) > 0) {
+        dir = OPENCL_CACHE_PATH;
+#endif
+    } else if (getenv("XDG_CACHE_HOME") && getenv("XDG_CACHE_HOME")[0] == '/') {
+        dir = std::string(getenv("XDG_CACHE_HOME")) + "/kfusion";
+    } else if (getenv("HOME") && getenv("HOME")[0] == '/') {
+        dir = std::string(getenv("HOME")) + "/.cache/kfusion";
+    }
+    if (dir.empty()) return dir;
+    make_private_dir(dir);
+    struct stat info;
+    if (lstat(dir.c_str(), &info) != 0 || !S_ISDIR(info.st_mode) || info.st_uid != geteuid()
+            || (info.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+        printf("WARNING: program cache '%s' is not a directory private to this user, caching disabled\n", dir.c_str());
+        dir.clear();
+    }
+    return dir;
+}
+
+// One cached binary per device, keyed by device name, driver version, build options and source
+static std::string cache_file(cl_device_id device, const char * source, const char * options) {
+    char device_name[256], driver_version[256];
+    clGetDeviceInfo(device, CL_DEVICE_NAME, 256, device_name, NULL);
+    clGetDeviceInfo(device, CL_DRIVER_VERSION, 256, driver_version, NULL);
+    uint64_t hash = fnv1a(device_name);
+    hash = fnv1a(driver_version, hash);
+    hash = fnv1a(options, hash);
+    hash = fnv1a(source, hash);
+    std::ostringstream path;
+    path << cache_dir() << "/" << std::hex << hash << ".bin";
+    return path.str();
+}
+
+static cl_program load_cached_program(cl_context context, cl_uint num_devices, const cl_device_id * devices, const char * source, const char * options) {
+    std::vector<std::string> binaries(num_devices);
+    std::vector<size_t> sizes(num_devices);
+    std::vector<const unsigned char *> pointers(num_devices);
+    if (cache_dir().empty()) return NULL;
+    for (cl_uint i = 0; i < num_devices; i++) {
+        std::ifstream file(cache_file(devices[i], source, options).c_str(), std::ios::in | std::ios::binary);
+        if (!file) return NULL;
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        binaries[i] = contents.str();
+        sizes[i] = binaries[i].size();
+        pointers[i] = (const unsigned char *) binaries[i].data();
+    }
+
+    cl_int status;
+    cl_program program = clCreateProgramWithBinary(context, num_devices, devices, &sizes[0], &pointers[0], NULL, &status);
+    if (status != CL_SUCCESS) return NULL;
+    if (clBuildProgram(program, 0, NULL, options, NULL, NULL) != CL_SUCCESS) {
+        // stale or foreign binary, rebuild from source
+        clReleaseProgram(program);
+        return NULL;
+    }
+    return program;
+}
+
+static void store_cached_program(cl_program program, cl_uint num_devices, const cl_device_id * devices, const char * source, const char * options) {
+    std::vector<size_t> sizes(num_devices);
+    if (cache_dir().empty()) return;
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, num_devices * sizeof(size_t), &sizes[0], NULL) != CL_SUCCESS) return;
+    std::vector<unsigned char *> binaries(num_devices);
+    for (cl_uint i = 0; i < num_devices; i++)
+        binaries[i] = (unsigned char *) malloc(sizes[i]);
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, num_devices * sizeof(unsigned char *), &binaries[0], NULL) == CL_SUCCESS) {
+        for (cl_uint i = 0; i < num_devices; i++) {
+            // write to a fresh file of this run and rename, so that concurrent runs never load a partial binary
+            std::string path = cache_file(devices[i], source, options);
+            std::vector<char> partial(path.begin(), path.end());
+            const char suffix[] = ".XXXXXX";
+            partial.insert(partial.end(), suffix, suffix + sizeof(suffix));
+            int fd = mkstemp(&partial[0]);
+            bool written = (fd >= 0);
+            for (size_t done = 0; written && done < sizes[i];) {
+                ssize_t n = write(fd, binaries[i] + done, sizes[i] - done);
+                written = (n > 0);
+                if (written) done += n;
+            }
+            if (fd >= 0 && close(fd) != 0) written = false;
+            if (!written || rename(&partial[0], path.c_str()) != 0) {
+                printf("WARNING: unable to write the program cache '%s'\n", path.c_str());
+                if (fd >= 0) remove(&partial[0]);
+            }
+        }
+    }
+    for (cl_uint i = 0; i < num_devices; i++)
+        free(binaries[i]);
+}
+
+cl_program build_program_cached(cl_context context, cl_uint num_devices, const cl_device_id * devices, const char * source, const char * options) {
+    double start = wall_time();
+    cl_program program = load_cached_program(context, num_devices, devices, source, options);
+    bool cache_hit = (program != NULL);
+
+    if (!cache_hit) {
+        program = clCreateProgramWithSource(context, 1, &source, NULL, &clError);
+        if (clError != CL_SUCCESS) {
+            printf("ERROR: clCreateProgramWithSource() => %d\n", clError);
+            return NULL;
+        }
+        clError = clBuildProgram(program, 0, NULL, options, NULL, NULL);
+        if (clError != CL_SUCCESS) {
+            printf("ERROR: clBuildProgram() => %d\n", clError);
+            return NULL;
+        }
+        store_cached_program(program, num_devices, devices, source, options);
+    }
+
+    double elapsed = wall_time() - start;
+    opencl_build_time += elapsed;
+    opencl_builds++;
+    if (cache_hit) opencl_cached_builds++;
+    printf("Program build: %f s (%s)\n", elapsed, cache_hit ? "cached binary" : "compiled from source");
+    return program;
+}
 
 int opencl_clean(void) {
 
@@ -49,12 +226,21 @@ int opencl_clean(void) {
     free(programs);
     free(contexts);
     free(platform_ids);
+    free(opencl_source);
+    opencl_source = NULL;
+    free(ocl_devices);
+    ocl_devices = NULL;
+    num_ocl_devices = 0;
 
     if (clError == CL_SUCCESS) return 0;
     else return -1;
 }
 
 int opencl_init(void) {
+    double start = wall_time();
+    opencl_build_time = 0.0;
+    opencl_builds = 0;
+    opencl_cached_builds = 0;
     size_t size;
     int ctxs_idx = 0;
     cl_uint num_devices;
@@ -131,6 +317,7 @@ int opencl_init(void) {
         printf("ERROR: Query for FPGA device ids\n");
         return -1;
     }
+    register_devices(0, num_devices);
 
     // create and build the FPGA program
     std::string binary_file = aocl_utils::getBoardBinaryFile(AOCX_PATH, device_lists[0][0]);
@@ -176,10 +363,12 @@ int opencl_init(void) {
             return -1;
         }   
     }
+    register_devices(1, num_devices);
 
     // try to read the kernel source
     int sourcesize = 1024*1024;
     char *source = (char *) calloc(sourcesize, sizeof(char)); 
+    opencl_source = source;
     if(!source) {
         printf("ERROR: calloc(%d) failed\n", sourcesize);
         return -1;
@@ -194,21 +383,16 @@ int opencl_init(void) {
     fread(source + strlen(source), sourcesize, 1, fp);
     fclose(fp);
 
-    cl_int clError = 0;
-    const char *slist[2] = { source, 0 };
-
     // create and build the GPU program
-    programs[1] = clCreateProgramWithSource(contexts[1], 1, slist, NULL, &clError);
-    if(clError != CL_SUCCESS) {
-        printf("ERROR: GPUs clCreateProgramWithSource() => %d\n", clError);
-        return -1;
-    }
-    clError = clBuildProgram(programs[1], 0, NULL, NULL, NULL, NULL);
-    if(clError != CL_SUCCESS) {
-        printf("ERROR: GPUs clBuildProgram() => %d\n", clError);
+    programs[1] = build_program_cached(contexts[1], num_devices, device_lists[1], source, "");
+    if(!programs[1]) {
+        printf("ERROR: GPUs program build failed\n");
         return -1;
     }
 
+    opencl_init_time = wall_time() - start;
+    printf("OpenCL init: %f s (program builds %f s)\n", opencl_init_time, opencl_build_time);
+
     return 0;
 
 }
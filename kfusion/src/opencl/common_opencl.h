@@ -30,6 +30,14 @@ extern cl_program        *programs;
 extern cl_device_id     **device_lists;
 extern cl_command_queue **cmd_queues;
 
+// flat numbering of the devices above, as used by the stage placement (devN)
+struct ocl_device_ref {
+	cl_uint platform;
+	cl_uint device;
+};
+extern cl_uint          num_ocl_devices;
+extern ocl_device_ref  *ocl_devices;
+
 extern size_t _ls[2];
 
 inline std::string descriptionOfError(cl_int err) {
@@ -149,6 +157,19 @@ inline void checkErrX(cl_int err, const char * name) {
 int opencl_init(void);
 int opencl_clean(void);
 
+// Build a program for the given devices, reusing the binaries cached on disk by a previous run
+cl_program build_program_cached(cl_context context, cl_uint num_devices, const cl_device_id * devices, const char * source, const char * options);
+
+// Source of kernels.cl, kept to build specialised variants
+extern char *opencl_source;
+
+// Duration of the last opencl_init(), and the time spent building programs since, with the
+// number of builds and how many of them loaded a cached binary
+extern double opencl_init_time;
+extern double opencl_build_time;
+extern unsigned int opencl_builds;
+extern unsigned int opencl_cached_builds;
+
 #define RELEASE_IN_BUFFER(name)  \
     clError = clReleaseMemObject(name##Buffer);\
 	checkErr( clError, "clReleaseMemObject");
@@ -22,9 +22,11 @@ typedef struct sVolume {
 	uint3 size;
 	// for volume (size) scaling?
 	float3 dim;
-	// data[0]: whether the point is behind or ahead
-	// data[1]: point certainty/confidence (there's a top threshold: maxweight)
-	__global short2 * data;
+	// data: whether the point is behind or ahead
+	__global short * data;
+	// weight: point certainty/confidence (there's a top threshold: maxweight)
+	// only integration reads or writes it, raycasting leaves it NULL
+	__global short * weight;
 } Volume;
 
 typedef struct sTrackData {
@@ -38,6 +40,16 @@ typedef struct sMatrix4 {
 	float4 data[4];
 } Matrix4;
 
+/************** SPECIALISATION ***************/
+
+// A program built with -DSPECIALISED bakes the run configuration in: the KF_* constants
+// passed by the host replace the matching kernel arguments, so loops unroll and constants fold.
+#ifdef SPECIALISED
+#define SPECIALISE(constant, argument) (constant)
+#else
+#define SPECIALISE(constant, argument) (argument)
+#endif
+
 /************** FUNCTIONS ***************/
 
 inline float sq(float r) {
@@ -55,7 +67,9 @@ inline float3 Mat4TimeFloat3(Matrix4 M, float3 v) {
 }
 
 inline void setVolume(Volume v, uint3 pos, float2 d) {
-	v.data[pos.x + pos.y * v.size.x + pos.z * v.size.x * v.size.y] = (short2)(d.x * MULTIPLIER, d.y);
+	const uint i = pos.x + pos.y * v.size.x + pos.z * v.size.x * v.size.y;
+	v.data[i] = d.x * MULTIPLIER;
+	v.weight[i] = d.y;
 }
 
 inline float3 posVolume(const Volume v, const uint3 p) {
@@ -65,13 +79,12 @@ inline float3 posVolume(const Volume v, const uint3 p) {
 }
 
 inline float2 getVolume(const Volume v, const uint3 pos) {
-	const short2 d = v.data[pos.x + pos.y * v.size.x
-			+ pos.z * v.size.x * v.size.y];
-	return (float2)(d.x * INVERSE_MULTIPLIER, d.y);
+	const uint i = pos.x + pos.y * v.size.x + pos.z * v.size.x * v.size.y;
+	return (float2)(v.data[i] * INVERSE_MULTIPLIER, v.weight[i]);
 }
 
 inline float vs(const uint3 pos, const Volume v) {
-	return v.data[pos.x + pos.y * v.size.x + pos.z * v.size.x * v.size.y].x;
+	return v.data[pos.x + pos.y * v.size.x + pos.z * v.size.x * v.size.y];
 }
 
 inline float interp(const float3 pos, const Volume v) {
@@ -344,9 +357,11 @@ __kernel void renderTrackKernel( __global uchar3 * restrict out,
 __kernel void bilateralFilterKernel( __global float * restrict out,
 		const __global float * restrict in,
 		const __global float * restrict gaussian,
-		const float e_d,
-		const int r ) {
+		const float e_d_arg,
+		const int r_arg ) {
 
+	const float e_d = SPECIALISE(KF_E_DELTA, e_d_arg);
+	const int r = SPECIALISE(KF_RADIUS, r_arg);
 	const uint2 pos = (uint2) (get_global_id(0),get_global_id(1));
 	const uint2 size = (uint2) (get_global_size(0),get_global_size(1));
 
@@ -379,7 +394,7 @@ __kernel void bilateralFilterKernel( __global float * restrict out,
 }
 
 __kernel void renderVolumeKernel( __global uchar * restrict render,
-		__global short2 * restrict v_data,
+		__global short * restrict v_data,
 		const uint3 v_size,
 		const float3 v_dim,
 		const Matrix4 view,
@@ -390,7 +405,7 @@ __kernel void renderVolumeKernel( __global uchar * restrict render,
 		const float3 light,
 		const float3 ambient) {
 
-	const Volume v = {v_size, v_dim,v_data};
+	const Volume v = {v_size, v_dim, v_data, 0};
 
 	const uint2 pos = (uint2) (get_global_id(0),get_global_id(1));
 	const int sizex = get_global_size(0);
@@ -418,16 +433,21 @@ __kernel void renderVolumeKernel( __global uchar * restrict render,
 
 __kernel void raycastKernel( __global float * restrict pos3D,  //float3
 		__global float * restrict normal,//float3
-		__global short2 * restrict v_data,
+		__global short * restrict v_data,
 		const uint3 v_size,
 		const float3 v_dim,
 		const Matrix4 view,
-		const float nearPlane,
-		const float farPlane,
-		const float step,
-		const float largestep ) {
-
-	const Volume volume = {v_size, v_dim, v_data};
+		const float nearPlane_arg,
+		const float farPlane_arg,
+		const float step_arg,
+		const float largestep_arg ) {
+
+	const Volume volume = {SPECIALISE(((uint3) (KF_VOLUME_X, KF_VOLUME_Y, KF_VOLUME_Z)), v_size),
+			SPECIALISE(((float3) (KF_VOLUME_DIM_X, KF_VOLUME_DIM_Y, KF_VOLUME_DIM_Z)), v_dim), v_data, 0};
+	const float nearPlane = SPECIALISE(KF_NEAR_PLANE, nearPlane_arg);
+	const float farPlane = SPECIALISE(KF_FAR_PLANE, farPlane_arg);
+	const float step = SPECIALISE(KF_STEP, step_arg);
+	const float largestep = SPECIALISE(KF_LARGESTEP, largestep_arg);
 
 	const uint2 pos = (uint2) (get_global_id(0), get_global_id(1));
 	const int sizex = get_global_size(0);
@@ -452,20 +472,26 @@ __kernel void raycastKernel( __global float * restrict pos3D,  //float3
 }
 
 __kernel void integrateKernel (
-		__global short2 * restrict v_data,
+		__global short * restrict v_data,
+		__global short * restrict v_weight,
 		const uint3 v_size,
 		const float3 v_dim,
 		__global const float * restrict depth,
-		const uint2 depthSize,
+		const uint2 depthSize_arg,
 		const Matrix4 invTrack,
 		const Matrix4 K,
-		const float mu,
-		const float maxweight,
+		const float mu_arg,
+		const float maxweight_arg,
 		const float3 delta,
 		const float3 cameraDelta
 ) {
 
-	Volume vol; vol.data = v_data; vol.size = v_size; vol.dim = v_dim;
+	Volume vol; vol.data = v_data; vol.weight = v_weight;
+	vol.size = SPECIALISE(((uint3) (KF_VOLUME_X, KF_VOLUME_Y, KF_VOLUME_Z)), v_size);
+	vol.dim = SPECIALISE(((float3) (KF_VOLUME_DIM_X, KF_VOLUME_DIM_Y, KF_VOLUME_DIM_Z)), v_dim);
+	const uint2 depthSize = SPECIALISE(((uint2) (KF_COMPUTE_X, KF_COMPUTE_Y)), depthSize_arg);
+	const float mu = SPECIALISE(KF_MU, mu_arg);
+	const float maxweight = SPECIALISE(KF_MAXWEIGHT, maxweight_arg);
 
 	uint3 pix = (uint3) (get_global_id(0), get_global_id(1), 0);
 	const int sizex = get_global_size(0);
@@ -522,10 +548,13 @@ __kernel void trackKernel (
 		const uint2 refNormalSize,
 		const Matrix4 Ttrack,
 		const Matrix4 view,
-		const float dist_threshold,
-		const float normal_threshold
+		const float dist_threshold_arg,
+		const float normal_threshold_arg
 ) {
 
+	const float dist_threshold = SPECIALISE(KF_DIST_THRESHOLD, dist_threshold_arg);
+	const float normal_threshold = SPECIALISE(KF_NORMAL_THRESHOLD, normal_threshold_arg);
+
 	const uint2 pixel = (uint2)(get_global_id(0),get_global_id(1));
 
 	if(pixel.x >= inVertexSize.x || pixel.y >= inVertexSize.y ) {return;}
@@ -584,9 +613,9 @@ __kernel void reduceKernel (
 ) {
 
 	uint blockIdx = get_group_id(0);
-	uint blockDim = get_local_size(0);
+	uint blockDim = SPECIALISE(KF_REDUCE_GROUP_SIZE, get_local_size(0));
 	uint threadIdx = get_local_id(0);
-	uint gridDim = get_num_groups(0);
+	uint gridDim = SPECIALISE(KF_REDUCE_GROUPS, get_num_groups(0));
 
 	const uint sline = threadIdx;
 
@@ -738,7 +767,7 @@ __kernel void mm2metersKernel(
 	depth[pixel.x + depthSize.x * pixel.y] = in[pixel.x * ratio + inSize.x * pixel.y * ratio] / 1000.0f;
 }
 
-__kernel void initVolumeKernel(__global short2 * data) {
+__kernel void initVolumeKernel(__global short * data, __global short * weight) {
 
 	uint x = get_global_id(0);
 	uint y = get_global_id(1);
@@ -746,7 +775,8 @@ __kernel void initVolumeKernel(__global short2 * data) {
 	uint3 size = (uint3) (get_global_size(0), get_global_size(1), get_global_size(2));
 	float2 d = (float2) (1.0f, 0.0f);
 
-	data[x + y * size.x + z * size.x * size.y] = (short2) (d.x * MULTIPLIER, d.y);
+	data[x + y * size.x + z * size.x * size.y] = d.x * MULTIPLIER;
+	weight[x + y * size.x + z * size.x * size.y] = d.y;
 
 }
 
@@ -9,13 +9,20 @@
 
 #include "common_opencl.h"
 #include <kernels.h>
+#include <marching_cubes.h>
+#include <checkpoint.h>
+#include <icp_budget.h>
 
 #include <TooN/TooN.h>
 #include <TooN/se3.h>
 #include <TooN/GR_SVD.h>
+#include <iomanip>
+#include <mutex>
+#include <condition_variable>
 
-inline double benchmark_tock() {
-	synchroniseDevices();
+void synchroniseStage();
+
+inline double host_clock() {
 #ifdef __APPLE__
 	clock_serv_t cclock;
 	mach_timespec_t clockData;
@@ -29,6 +36,11 @@ inline double benchmark_tock() {
 	return (double) clockData.tv_sec + clockData.tv_nsec / 1000000000.0;
 }
 
+inline double benchmark_tock() {
+	synchroniseStage();
+	return host_clock();
+}
+
 double startOfKernel, endOfKernel;
 
 ////// USE BY KFUSION CLASS ///////////////
@@ -36,24 +48,366 @@ double startOfKernel, endOfKernel;
 // input once
 cl_mem ocl_gaussian = NULL;
 
+// Device placement: every pipeline stage enqueues on the queue of its own device.
+// Buffers flowing between stages are StageBuffers, migrated when the stages are placed apart.
+enum PipelineStage {
+	STAGE_PREPROCESS, STAGE_TRACK, STAGE_INTEGRATE, STAGE_RAYCAST, STAGE_RENDER, STAGE_COUNT
+};
+static const char * stage_names[STAGE_COUNT] = { "preprocess", "track", "integrate", "raycast", "render" };
+
+std::string device_placement = "";
+int stage_device[STAGE_COUNT];             // index in ocl_devices
+cl_command_queue * transfer_queues = NULL; // per device, only for split placements
+PipelineStage active_stage = STAGE_PREPROCESS;
+
+struct StageBuffer {
+	size_t size;
+	unsigned int consumers; // mask of the stages reading it
+	int writer;             // stage which produced the current contents, -1 if none
+	cl_mem * mem;           // one copy per platform context, created on first use
+	bool * valid;           // per platform, the copy holds the current contents
+	cl_event written;       // end of the writer's commands
+	cl_event staged;        // current contents read back to staging
+	cl_event * uploaded;    // per platform, last upload from staging
+	void * staging;
+};
+
+void setDevicePlacement(const std::string & placement) {
+	device_placement = placement;
+}
+
+inline const ocl_device_ref & stageDevice(PipelineStage stage) {
+	return ocl_devices[stage_device[stage]];
+}
+inline cl_uint stagePlatform(PipelineStage stage) {
+	return stageDevice(stage).platform;
+}
+inline cl_context stageContext(PipelineStage stage) {
+	return contexts[stagePlatform(stage)];
+}
+inline cl_program stageProgram(PipelineStage stage) {
+	return programs[stagePlatform(stage)];
+}
+inline cl_command_queue stageQueue(PipelineStage stage) {
+	return cmd_queues[stageDevice(stage).platform][stageDevice(stage).device];
+}
+
+void parseDevicePlacement() {
+	// By default everything runs on the first device of the compute platform
+	int default_device = 0;
+	for (cl_uint i = 0; i < num_ocl_devices; ++i) {
+		if (ocl_devices[i].platform == 1 && ocl_devices[i].device == 0) {
+			default_device = i;
+			break;
+		}
+	}
+	for (int s = 0; s < STAGE_COUNT; ++s)
+		stage_device[s] = default_device;
+
+	std::istringstream entries(device_placement);
+	std::string entry;
+	while (getline(entries, entry, ',')) {
+		size_t eq = entry.find('=');
+		int stage = -1;
+		for (int s = 0; s < STAGE_COUNT && eq != std::string::npos; ++s)
+			if (entry.compare(0, eq, stage_names[s]) == 0) stage = s;
+		int device = -1;
+		if (stage >= 0 && entry.compare(eq + 1, 3, "dev") == 0) {
+			char * end;
+			device = strtol(entry.c_str() + eq + 4, &end, 10);
+			if (*end != 0 || end == entry.c_str() + eq + 4) device = -1;
+		}
+		if (device < 0 || device >= (int) num_ocl_devices) {
+			std::cerr << "Invalid device placement: " << entry << std::endl;
+			exit(1);
+		}
+		stage_device[stage] = device;
+	}
+
+	bool split = false;
+	for (int s = 0; s < STAGE_COUNT; ++s) {
+		if (stage_device[s] != stage_device[0]) split = true;
+		if (device_placement != "")
+			std::cerr << "Stage " << stage_names[s] << " on dev" << stage_device[s] << std::endl;
+	}
+	if (!split) return;
+
+	// Migrations get their own queue on the producing device so they overlap with the next stage
+	transfer_queues = (cl_command_queue *) calloc(num_ocl_devices, sizeof(cl_command_queue));
+	for (int s = 0; s < STAGE_COUNT; ++s) {
+		int d = stage_device[s];
+		if (transfer_queues[d]) continue;
+		transfer_queues[d] = clCreateCommandQueue(contexts[ocl_devices[d].platform], device_lists[ocl_devices[d].platform][ocl_devices[d].device], 0, &clError);
+		checkErr(clError, "clCreateCommandQueue");
+	}
+}
+
+void releaseEvent(cl_event & event) {
+	if (event) {
+		clError = clReleaseEvent(event);
+		checkErr(clError, "clReleaseEvent");
+		event = NULL;
+	}
+}
+
+void createStageBuffer(StageBuffer & b, size_t size, unsigned int consumers) {
+	b.size = size;
+	b.consumers = consumers;
+	b.writer = -1;
+	b.mem = (cl_mem *) calloc(num_platforms, sizeof(cl_mem));
+	b.valid = (bool *) calloc(num_platforms, sizeof(bool));
+	b.written = NULL;
+	b.staged = NULL;
+	b.uploaded = (cl_event *) calloc(num_platforms, sizeof(cl_event));
+	b.staging = NULL;
+}
+
+void releaseStageBuffer(StageBuffer & b) {
+	if (b.mem == NULL) return;
+	releaseEvent(b.written);
+	releaseEvent(b.staged);
+	for (cl_uint p = 0; p < num_platforms; ++p) {
+		releaseEvent(b.uploaded[p]);
+		if (b.mem[p]) {
+			clError = clReleaseMemObject(b.mem[p]);
+			checkErr(clError, "clReleaseMem");
+		}
+	}
+	free(b.mem);
+	free(b.valid);
+	free(b.uploaded);
+	if (b.staging) free(b.staging);
+	b.mem = NULL;
+	b.staging = NULL;
+}
+
+// The copy of b in the context of stage, for kernels which overwrite it
+cl_mem stageBuffer(StageBuffer & b, PipelineStage stage) {
+	cl_uint p = stagePlatform(stage);
+	if (b.mem[p] == NULL) {
+		b.mem[p] = clCreateBuffer(contexts[p], CL_MEM_READ_WRITE, b.size, NULL, &clError);
+		checkErr(clError, "clCreateBuffer");
+	}
+	// a pending read-back still needs the previous contents
+	if (b.staged) {
+		clError = clWaitForEvents(1, &b.staged);
+		checkErr(clError, "clWaitForEvents");
+	}
+	return b.mem[p];
+}
+
+void stageContents(StageBuffer & b) {
+	PipelineStage writer = (PipelineStage) b.writer;
+	if (b.staging == NULL) b.staging = malloc(b.size);
+	for (cl_uint p = 0; p < num_platforms; ++p) {
+		if (b.uploaded[p]) {
+			clError = clWaitForEvents(1, &b.uploaded[p]);
+			checkErr(clError, "clWaitForEvents");
+			releaseEvent(b.uploaded[p]);
+		}
+	}
+	cl_command_queue queue = transfer_queues[stage_device[writer]];
+	clError = clEnqueueReadBuffer(queue, b.mem[stagePlatform(writer)], CL_FALSE, 0, b.size, b.staging, 1, &b.written, &b.staged);
+	checkErr(clError, "clEnqueueReadBuffer");
+	clError = clFlush(queue);
+	checkErr(clError, "clFlush");
+}
+
+// Record new contents of b written by stage, and start moving them to consumers in other contexts
+void publishBuffer(StageBuffer & b, PipelineStage stage) {
+	b.writer = stage;
+	if (transfer_queues == NULL) return;
+
+	releaseEvent(b.written);
+	releaseEvent(b.staged);
+	for (cl_uint p = 0; p < num_platforms; ++p)
+		b.valid[p] = (p == stagePlatform(stage));
+	clError = clEnqueueMarkerWithWaitList(stageQueue(stage), 0, NULL, &b.written);
+	checkErr(clError, "clEnqueueMarkerWithWaitList");
+	clError = clFlush(stageQueue(stage));
+	checkErr(clError, "clFlush");
+
+	for (int s = 0; s < STAGE_COUNT; ++s) {
+		if ((b.consumers & (1 << s)) && stagePlatform((PipelineStage) s) != stagePlatform(stage)) {
+			stageContents(b);
+			break;
+		}
+	}
+}
+
+// The copy of b in the context of stage, holding the current contents once the stage queue reaches it
+cl_mem acquireBuffer(StageBuffer & b, PipelineStage stage) {
+	cl_mem mem = stageBuffer(b, stage);
+	if (b.writer < 0 || stageQueue((PipelineStage) b.writer) == stageQueue(stage))
+		return mem;
+
+	cl_uint p = stagePlatform(stage);
+	if (b.valid[p]) {
+		// same context: the runtime migrates the buffer, only order the queues
+		cl_event ready = (p == stagePlatform((PipelineStage) b.writer)) ? b.written : b.uploaded[p];
+		if (ready) {
+			clError = clEnqueueBarrierWithWaitList(stageQueue(stage), 1, &ready, NULL);
+			checkErr(clError, "clEnqueueBarrierWithWaitList");
+		}
+		return mem;
+	}
+
+	// other context: upload the read-back started when the writer published
+	if (b.staged == NULL) stageContents(b);
+	clError = clWaitForEvents(1, &b.staged);
+	checkErr(clError, "clWaitForEvents");
+	releaseEvent(b.uploaded[p]);
+	clError = clEnqueueWriteBuffer(stageQueue(stage), mem, CL_FALSE, 0, b.size, b.staging, 0, NULL, &b.uploaded[p]);
+	checkErr(clError, "clEnqueueWriteBuffer");
+	b.valid[p] = true;
+	return mem;
+}
+
+// Split integration: volume rows [0, deviceRows) go to the device, the others to the host with OpenMP
+float integration_device_share = 1.0f;
+VolumeT<VoxelShort> host_volume;  // host copy of the volume, rows from host_rows_begin are current
+unsigned int host_rows_begin = 0;
+float * host_depth = NULL;
+// set by the completion callback of the device slab, which runs on a runtime thread
+std::mutex integrate_device_lock;
+std::condition_variable integrate_device_wake;
+bool integrate_device_done = false;
+double integrate_device_end = 0.0;
+
+void setIntegrationSplit(float deviceShare) {
+	integration_device_share = deviceShare;
+}
+
+void CL_CALLBACK integrateDeviceCallback(cl_event, cl_int, void *) {
+	const double end = host_clock();
+	std::lock_guard<std::mutex> guard(integrate_device_lock);
+	integrate_device_end = end;
+	integrate_device_done = true;
+	integrate_device_wake.notify_one();
+}
+
+// reduction parameters
+static const size_t size_of_group = 64;
+static const size_t number_of_groups = 8;
+
+// Specialised kernels: built with the run configuration as -D constants (see kernels.cl).
+// Calls alternate with the generic kernel, so both are timed on the same frames.
+enum KernelVariant {
+	VARIANT_BILATERAL, VARIANT_TRACK, VARIANT_REDUCE, VARIANT_INTEGRATE, VARIANT_RAYCAST, VARIANT_COUNT
+};
+
+struct SpecialisedKernel {
+	const char * name;
+	PipelineStage stage;
+	cl_kernel kernel;
+	unsigned int calls;
+	int last;               // 1 if the last call used the specialised kernel
+	double time[2];         // generic, specialised
+	unsigned int count[2];
+};
+
+SpecialisedKernel specialised[VARIANT_COUNT] = {
+	{ "bilateralFilterKernel", STAGE_PREPROCESS },
+	{ "trackKernel", STAGE_TRACK },
+	{ "reduceKernel", STAGE_TRACK },
+	{ "integrateKernel", STAGE_INTEGRATE },
+	{ "raycastKernel", STAGE_RAYCAST },
+};
+bool specialise_kernels = false;
+float specialised_mu = 0.0f;
+cl_program * specialised_programs = NULL; // per platform
+
+void setSpecialisedKernels(bool enable, float mu) {
+	specialise_kernels = enable;
+	specialised_mu = mu;
+}
+
+void buildSpecialisedKernels(uint2 computationSize, uint3 volumeResolution, float3 volumeDimensions, float step) {
+	std::ostringstream options;
+	options << std::showpoint << std::setprecision(9) << "-DSPECIALISED"
+			<< " -DKF_RADIUS=" << radius << " -DKF_E_DELTA=" << e_delta << "f"
+			<< " -DKF_REDUCE_GROUP_SIZE=" << size_of_group << " -DKF_REDUCE_GROUPS=" << number_of_groups
+			<< " -DKF_COMPUTE_X=" << computationSize.x << " -DKF_COMPUTE_Y=" << computationSize.y
+			<< " -DKF_VOLUME_X=" << volumeResolution.x << " -DKF_VOLUME_Y=" << volumeResolution.y << " -DKF_VOLUME_Z=" << volumeResolution.z
+			<< " -DKF_VOLUME_DIM_X=" << volumeDimensions.x << "f -DKF_VOLUME_DIM_Y=" << volumeDimensions.y << "f -DKF_VOLUME_DIM_Z=" << volumeDimensions.z << "f"
+			<< " -DKF_MU=" << specialised_mu << "f -DKF_MAXWEIGHT=" << maxweight << "f"
+			<< " -DKF_NEAR_PLANE=" << nearPlane << "f -DKF_FAR_PLANE=" << farPlane << "f"
+			<< " -DKF_STEP=" << step << "f -DKF_LARGESTEP=" << specialised_mu * 0.75f << "f"
+			<< " -DKF_DIST_THRESHOLD=" << dist_threshold << "f -DKF_NORMAL_THRESHOLD=" << normal_threshold << "f";
+
+	specialised_programs = (cl_program *) calloc(num_platforms, sizeof(cl_program));
+	for (int v = 0; v < VARIANT_COUNT; ++v) {
+		cl_uint p = stagePlatform(specialised[v].stage);
+		if (p == 0) {
+			// the FPGA program is a precompiled AOCX binary
+			std::cerr << "No specialised " << specialised[v].name << " on the FPGA platform" << std::endl;
+			continue;
+		}
+		if (specialised_programs[p] == NULL) {
+			cl_uint num_devices = 0;
+			for (cl_uint d = 0; d < num_ocl_devices; ++d)
+				if (ocl_devices[d].platform == p) num_devices++;
+			specialised_programs[p] = build_program_cached(contexts[p], num_devices, device_lists[p], opencl_source, options.str().c_str());
+			if (specialised_programs[p] == NULL) exit(1);
+		}
+		specialised[v].kernel = clCreateKernel(specialised_programs[p], specialised[v].name, &clError);
+		checkErr(clError, "clCreateKernel");
+	}
+}
+
+// The kernel for this call: the specialised one every other call, if it exists and matches the arguments
+cl_kernel useVariant(KernelVariant v, cl_kernel generic, bool matching = true) {
+	SpecialisedKernel & k = specialised[v];
+	k.last = (k.kernel != NULL && matching && (k.calls++ % 2 == 1)) ? 1 : 0;
+	return k.last ? k.kernel : generic;
+}
+
+void timeVariant(KernelVariant v, double elapsed) {
+	SpecialisedKernel & k = specialised[v];
+	if (k.kernel == NULL) return;
+	k.time[k.last] += elapsed;
+	k.count[k.last]++;
+}
+
+void reportSpecialisedKernels(std::ostream & out) {
+	out << "kernel\tgeneric\tspecialised\tspeedup" << std::endl;
+	for (int v = 0; v < VARIANT_COUNT; ++v) {
+		SpecialisedKernel & k = specialised[v];
+		if (k.kernel == NULL || k.count[0] == 0 || k.count[1] == 0) continue;
+		const double generic = k.time[0] / k.count[0];
+		const double special = k.time[1] / k.count[1];
+		out << k.name << "\t" << generic << "\t" << special << "\t" << generic / special << std::endl;
+	}
+}
+
 // inter-frame
 Matrix4 oldPose;
 Matrix4 raycastPose;
-cl_mem ocl_vertex = NULL;
-cl_mem ocl_normal = NULL;
-cl_mem ocl_volume_data = NULL;
+StageBuffer ocl_vertex = { 0 };
+StageBuffer ocl_normal = { 0 };
+StageBuffer ocl_volume_data = { 0 };
+cl_mem ocl_volume_weight = NULL;  // weights stay with the integration stage, raycast reads only ocl_volume_data
 cl_mem ocl_depth_buffer = NULL;
 cl_mem ocl_output_render_buffer = NULL; // Common buffer for rendering track, depth and volume
 
 // intra-frame
 cl_mem ocl_reduce_output_buffer = NULL;
-cl_mem ocl_trackingResult = NULL;
-cl_mem ocl_FloatDepth = NULL;
+StageBuffer ocl_trackingResult = { 0 };
+StageBuffer ocl_FloatDepth = { 0 };
+StageBuffer ocl_filteredDepth = { 0 }; // pyramid level 0
 cl_mem * ocl_ScaledDepth = NULL;
 cl_mem * ocl_inputVertex = NULL;
 cl_mem * ocl_inputNormal = NULL;
 float * reduceOutputBuffer = NULL;
 
+// motion model, the pose tracked the frame before last
+float motion_damping = -1.0f;
+Matrix4 motion_previous;
+
+// ICP iterations per level, moved between levels by their recent convergence when adaptive
+IcpBudget icp_budget;
+bool adaptive_icp = false;
+
 // kernels
 cl_kernel mm2meters_ocl_kernel;
 cl_kernel bilateralFilter_ocl_kernel;
@@ -70,13 +424,96 @@ cl_kernel renderTrack_ocl_kernel;
 cl_kernel renderDepth_ocl_kernel;
 cl_kernel initVolume_ocl_kernel;
 
-// reduction parameters
-static const size_t size_of_group = 64;
-static const size_t number_of_groups = 8;
-
 uint2 computationSizeBkp = make_uint2(0, 0);
 uint2 outputImageSizeBkp = make_uint2(0, 0);
 
+// zero-copy: device buffers wrapping the caller's host memory (CL_MEM_USE_HOST_PTR).
+// On CPU and integrated GPU devices map/unmap is then free, instead of a memcpy per frame.
+struct HostVisibleBuffer {
+	void * host;
+	size_t size;
+	cl_mem buffer;
+	void * mapped; // host view while mapped for the host to write, NULL otherwise
+};
+
+bool zero_copy = false;
+HostVisibleBuffer ocl_depth_host = { NULL, 0, NULL, NULL };
+HostVisibleBuffer ocl_render_host[3] = { { NULL, 0, NULL, NULL }, { NULL, 0, NULL, NULL }, { NULL, 0, NULL, NULL } }; // depth, track, volume
+
+void setZeroCopy(bool enable) {
+	zero_copy = enable;
+}
+
+// Ends a mapping: the device then sees what the host wrote, or may overwrite what the host read
+void unmapHostBuffer(HostVisibleBuffer & b, PipelineStage stage) {
+	if (b.mapped == NULL)
+		return;
+	clError = clEnqueueUnmapMemObject(stageQueue(stage), b.buffer, b.mapped, 0, NULL, NULL);
+	checkErr(clError, "clEnqueueUnmapMemObject");
+	b.mapped = NULL;
+}
+
+cl_mem wrapHostBuffer(HostVisibleBuffer & b, void * host, size_t size, cl_mem_flags flags, PipelineStage stage) {
+	if (b.buffer != NULL && b.host == host && b.size >= size)
+		return b.buffer;
+	unmapHostBuffer(b, stage);
+	if (b.buffer != NULL) {
+		clError = clReleaseMemObject(b.buffer);
+		checkErr(clError, "clReleaseMemObject");
+	}
+	b.buffer = clCreateBuffer(stageContext(stage), flags | CL_MEM_USE_HOST_PTR, size, host, &clError);
+	checkErr(clError, "clCreateBuffer host");
+	b.host = host;
+	b.size = size;
+	return b.buffer;
+}
+
+void releaseHostBuffer(HostVisibleBuffer & b) {
+	if (b.buffer) {
+		clError = clReleaseMemObject(b.buffer);
+		checkErr(clError, "clReleaseMem");
+	}
+	b.host = NULL;
+	b.size = 0;
+	b.buffer = NULL;
+}
+
+// Returns the buffer the render kernels write into: the shared device buffer, or the caller's memory with zero-copy,
+// whose mapping from the previous frame is ended here, once the host is done with that image
+cl_mem renderOutputBuffer(int slot, uchar4 * out, uint2 outputSize) {
+	if (zero_copy) {
+		cl_mem buffer = wrapHostBuffer(ocl_render_host[slot], out, outputSize.x * outputSize.y * sizeof(uchar4), CL_MEM_WRITE_ONLY, STAGE_RENDER);
+		unmapHostBuffer(ocl_render_host[slot], STAGE_RENDER);
+		return buffer;
+	}
+
+	// Create render opencl buffer if needed
+	if (outputImageSizeBkp.x < outputSize.x || outputImageSizeBkp.y < outputSize.y || ocl_output_render_buffer == NULL) {
+		outputImageSizeBkp = make_uint2(outputSize.x, outputSize.y);
+		if (ocl_output_render_buffer != NULL) {
+			std::cout << "Release" << std::endl;
+			clError = clReleaseMemObject(ocl_output_render_buffer);
+			checkErr(clError, "clReleaseMemObject");
+		}
+		ocl_output_render_buffer = clCreateBuffer(stageContext(STAGE_RENDER), CL_MEM_WRITE_ONLY, outputSize.x * outputSize.y * sizeof(uchar4), NULL, &clError);
+		checkErr(clError, "clCreateBuffer output");
+	}
+	return ocl_output_render_buffer;
+}
+
+// Bring a rendered image back to the host: a blocking map of the caller's own memory with zero-copy, kept
+// until the next render into the same slot, as the depth input is; a read otherwise
+void readRenderOutput(int slot, cl_mem buffer, uchar4 * out, uint2 outputSize) {
+	const size_t size = outputSize.x * outputSize.y * sizeof(uchar4);
+	if (zero_copy) {
+		ocl_render_host[slot].mapped = clEnqueueMapBuffer(stageQueue(STAGE_RENDER), buffer, CL_TRUE, CL_MAP_READ, 0, size, 0, NULL, NULL, &clError);
+		checkErr(clError, "clEnqueueMapBuffer");
+	} else {
+		clError = clEnqueueReadBuffer(stageQueue(STAGE_RENDER), buffer, CL_FALSE, 0, size, out, 0, NULL, NULL);
+		checkErr(clError, "clEnqueueReadBuffer");
+	}
+}
+
 void init() {
 	if (opencl_init()) exit(1);
 }
@@ -87,10 +524,18 @@ void clean() {
 
 void Kfusion::languageSpecificConstructor() {
 	init();
+	parseDevicePlacement();
+	motion_previous = pose;
+	icp_budget.init(iterations);
+
+	cl_ulong maxMemAlloc = 0;
+	for (int s = 0; s < STAGE_COUNT; ++s) {
+		cl_ulong deviceMemAlloc;
+		const ocl_device_ref & d = stageDevice((PipelineStage) s);
+		clGetDeviceInfo(device_lists[d.platform][d.device], CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(deviceMemAlloc), &deviceMemAlloc, NULL);
+		if (s == 0 || deviceMemAlloc < maxMemAlloc) maxMemAlloc = deviceMemAlloc;
+	}
 
-	cl_ulong maxMemAlloc;
-	clGetDeviceInfo(device_lists[1][0], CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxMemAlloc), &maxMemAlloc, NULL);
-	
 	if (maxMemAlloc < sizeof(float4) * computationSize.x * computationSize.y) {
 		std::cerr << "OpenCL maximum allocation does not support the computation size." << std::endl;
 		exit(1);
@@ -99,34 +544,35 @@ void Kfusion::languageSpecificConstructor() {
 		std::cerr << "OpenCL maximum allocation does not support the computation size." << std::endl;
 		exit(1);
 	}
-	if (maxMemAlloc < sizeof(short2) * volumeResolution.x * volumeResolution.y * volumeResolution.z) {
+	if (maxMemAlloc < sizeof(short) * volumeResolution.x * volumeResolution.y * volumeResolution.z) {
 		std::cerr << "OpenCL maximum allocation does not support the volume resolution." << std::endl;
 		exit(1);
 	}
 	
-	ocl_FloatDepth = clCreateBuffer(contexts[1], CL_MEM_READ_WRITE, sizeof(float) * computationSize.x * computationSize.y, NULL, &clError);
-	checkErr(clError, "clCreateBuffer");
+	createStageBuffer(ocl_FloatDepth, sizeof(float) * computationSize.x * computationSize.y, (1 << STAGE_INTEGRATE) | (1 << STAGE_RENDER));
+	createStageBuffer(ocl_filteredDepth, sizeof(float) * computationSize.x * computationSize.y, 1 << STAGE_TRACK);
 	ocl_ScaledDepth = (cl_mem*) malloc(sizeof(cl_mem) * iterations.size());
 	ocl_inputVertex = (cl_mem*) malloc(sizeof(cl_mem) * iterations.size());
 	ocl_inputNormal = (cl_mem*) malloc(sizeof(cl_mem) * iterations.size());
 
 	for (unsigned int i = 0; i < iterations.size(); ++i) {
-		ocl_ScaledDepth[i] = clCreateBuffer(contexts[1], CL_MEM_READ_WRITE, sizeof(float) * (computationSize.x * computationSize.y) / (int) pow(2, i), NULL, &clError);
-		checkErr(clError, "clCreateBuffer");
-		ocl_inputVertex[i] = clCreateBuffer(contexts[1], CL_MEM_READ_WRITE, sizeof(float3) * (computationSize.x * computationSize.y) / (int) pow(2, i), NULL, &clError);
+		// level 0 is acquired from ocl_filteredDepth on every tracking call
+		ocl_ScaledDepth[i] = NULL;
+		if (i > 0) {
+			ocl_ScaledDepth[i] = clCreateBuffer(stageContext(STAGE_TRACK), CL_MEM_READ_WRITE, sizeof(float) * (computationSize.x * computationSize.y) / (int) pow(2, i), NULL, &clError);
+			checkErr(clError, "clCreateBuffer");
+		}
+		ocl_inputVertex[i] = clCreateBuffer(stageContext(STAGE_TRACK), CL_MEM_READ_WRITE, sizeof(float3) * (computationSize.x * computationSize.y) / (int) pow(2, i), NULL, &clError);
 		checkErr(clError, "clCreateBuffer");
-		ocl_inputNormal[i] = clCreateBuffer(contexts[1], CL_MEM_READ_WRITE, sizeof(float3) * (computationSize.x * computationSize.y) / (int) pow(2, i), NULL, &clError);
+		ocl_inputNormal[i] = clCreateBuffer(stageContext(STAGE_TRACK), CL_MEM_READ_WRITE, sizeof(float3) * (computationSize.x * computationSize.y) / (int) pow(2, i), NULL, &clError);
 		checkErr(clError, "clCreateBuffer");
 	}
 
-	ocl_vertex = clCreateBuffer(contexts[1], CL_MEM_READ_WRITE, sizeof(float3) * computationSize.x * computationSize.y, NULL, &clError);
-	checkErr(clError, "clCreateBuffer");
-	ocl_normal = clCreateBuffer(contexts[1], CL_MEM_READ_WRITE, sizeof(float3) * computationSize.x * computationSize.y, NULL, &clError);
-	checkErr(clError, "clCreateBuffer");
-	ocl_trackingResult = clCreateBuffer(contexts[1], CL_MEM_READ_WRITE, sizeof(TrackData) * computationSize.x * computationSize.y, NULL, &clError);
-	checkErr(clError, "clCreateBuffer");
+	createStageBuffer(ocl_vertex, sizeof(float3) * computationSize.x * computationSize.y, 1 << STAGE_TRACK);
+	createStageBuffer(ocl_normal, sizeof(float3) * computationSize.x * computationSize.y, 1 << STAGE_TRACK);
+	createStageBuffer(ocl_trackingResult, sizeof(TrackData) * computationSize.x * computationSize.y, 1 << STAGE_RENDER);
 
-	ocl_reduce_output_buffer = clCreateBuffer(contexts[1], CL_MEM_WRITE_ONLY, 32 * number_of_groups * sizeof(float), NULL, &clError);
+	ocl_reduce_output_buffer = clCreateBuffer(stageContext(STAGE_TRACK), CL_MEM_WRITE_ONLY, 32 * number_of_groups * sizeof(float), NULL, &clError);
 	checkErr(clError, "clCreateBuffer");
 	reduceOutputBuffer = (float*) malloc(number_of_groups * 32 * sizeof(float));
 	// ********* BEGIN : Generate the gaussian *************
@@ -137,59 +583,67 @@ void Kfusion::languageSpecificConstructor() {
 		x = i - 2;
 		gaussian[i] = expf(-(x * x) / (2 * delta * delta));
 	}
-	ocl_gaussian = clCreateBuffer(contexts[1], CL_MEM_READ_ONLY, gaussianS * sizeof(float), NULL, &clError);
+	ocl_gaussian = clCreateBuffer(stageContext(STAGE_PREPROCESS), CL_MEM_READ_ONLY, gaussianS * sizeof(float), NULL, &clError);
 	checkErr(clError, "clCreateBuffer");
-	clError = clEnqueueWriteBuffer(cmd_queues[1][0], ocl_gaussian, CL_TRUE, 0, gaussianS * sizeof(float), gaussian, 0, NULL, NULL);
+	clError = clEnqueueWriteBuffer(stageQueue(STAGE_PREPROCESS), ocl_gaussian, CL_TRUE, 0, gaussianS * sizeof(float), gaussian, 0, NULL, NULL);
 	checkErr(clError, "clEnqueueWrite");
 	free(gaussian);
 	// ********* END : Generate the gaussian *************
 
 	// Create kernel
-	initVolume_ocl_kernel = clCreateKernel(programs[1], "initVolumeKernel", &clError);
+	initVolume_ocl_kernel = clCreateKernel(stageProgram(STAGE_INTEGRATE), "initVolumeKernel", &clError);
 	checkErr(clError, "clCreateKernel");
 
-	ocl_volume_data = clCreateBuffer(contexts[1], CL_MEM_READ_WRITE, sizeof(short2) * volumeResolution.x * volumeResolution.y * volumeResolution.z, NULL, &clError);
+	createStageBuffer(ocl_volume_data, sizeof(short) * volumeResolution.x * volumeResolution.y * volumeResolution.z, (1 << STAGE_RAYCAST) | (1 << STAGE_RENDER));
+	ocl_volume_weight = clCreateBuffer(stageContext(STAGE_INTEGRATE), CL_MEM_READ_WRITE, sizeof(short) * volumeResolution.x * volumeResolution.y * volumeResolution.z, NULL, &clError);
 	checkErr(clError, "clCreateBuffer");
-	clError = clSetKernelArg(initVolume_ocl_kernel, 0, sizeof(cl_mem), &ocl_volume_data);
+	cl_mem volume = stageBuffer(ocl_volume_data, STAGE_INTEGRATE);
+	clError = clSetKernelArg(initVolume_ocl_kernel, 0, sizeof(cl_mem), &volume);
+	checkErr(clError, "clSetKernelArg");
+	clError = clSetKernelArg(initVolume_ocl_kernel, 1, sizeof(cl_mem), &ocl_volume_weight);
 	checkErr(clError, "clSetKernelArg");
 
 	size_t globalWorksize[3] = { volumeResolution.x, volumeResolution.y, volumeResolution.z };
-	clError = clEnqueueNDRangeKernel(cmd_queues[1][0], initVolume_ocl_kernel, 3, NULL, globalWorksize, NULL, 0, NULL, NULL);
+	clError = clEnqueueNDRangeKernel(stageQueue(STAGE_INTEGRATE), initVolume_ocl_kernel, 3, NULL, globalWorksize, NULL, 0, NULL, NULL);
 	checkErr(clError, "clEnqueueNDRangeKernel");
+	publishBuffer(ocl_volume_data, STAGE_INTEGRATE);
 
 	//Kernels
-	mm2meters_ocl_kernel = clCreateKernel(programs[1], "mm2metersKernel", &clError);
+	mm2meters_ocl_kernel = clCreateKernel(stageProgram(STAGE_PREPROCESS), "mm2metersKernel", &clError);
 	checkErr(clError, "clCreateKernel");
-	bilateralFilter_ocl_kernel = clCreateKernel(programs[1], "bilateralFilterKernel", &clError);
+	bilateralFilter_ocl_kernel = clCreateKernel(stageProgram(STAGE_PREPROCESS), "bilateralFilterKernel", &clError);
 	checkErr(clError, "clCreateKernel");
-	halfSampleRobustImage_ocl_kernel = clCreateKernel(programs[1], "halfSampleRobustImageKernel", &clError);
+	halfSampleRobustImage_ocl_kernel = clCreateKernel(stageProgram(STAGE_TRACK), "halfSampleRobustImageKernel", &clError);
 	checkErr(clError, "clCreateKernel");
-	depth2vertex_ocl_kernel = clCreateKernel(programs[1], "depth2vertexKernel", &clError);
+	depth2vertex_ocl_kernel = clCreateKernel(stageProgram(STAGE_TRACK), "depth2vertexKernel", &clError);
 	checkErr(clError, "clCreateKernel");
-	vertex2normal_ocl_kernel = clCreateKernel(programs[1], "vertex2normalKernel", &clError);
+	vertex2normal_ocl_kernel = clCreateKernel(stageProgram(STAGE_TRACK), "vertex2normalKernel", &clError);
 	checkErr(clError, "clCreateKernel");
-	track_ocl_kernel = clCreateKernel(programs[1], "trackKernel", &clError);
+	track_ocl_kernel = clCreateKernel(stageProgram(STAGE_TRACK), "trackKernel", &clError);
 	checkErr(clError, "clCreateKernel");
-	reduce_ocl_kernel = clCreateKernel(programs[1], "reduceKernel", &clError);
+	reduce_ocl_kernel = clCreateKernel(stageProgram(STAGE_TRACK), "reduceKernel", &clError);
 	checkErr(clError, "clCreateKernel");
-	integrate_ocl_kernel = clCreateKernel(programs[1], "integrateKernel", &clError);
+	integrate_ocl_kernel = clCreateKernel(stageProgram(STAGE_INTEGRATE), "integrateKernel", &clError);
 	checkErr(clError, "clCreateKernel");
-	raycast_ocl_kernel = clCreateKernel(programs[1], "raycastKernel", &clError);
+	raycast_ocl_kernel = clCreateKernel(stageProgram(STAGE_RAYCAST), "raycastKernel", &clError);
 	checkErr(clError, "clCreateKernel");
-	renderVolume_ocl_kernel = clCreateKernel(programs[1], "renderVolumeKernel", &clError);
+	renderVolume_ocl_kernel = clCreateKernel(stageProgram(STAGE_RENDER), "renderVolumeKernel", &clError);
 	checkErr(clError, "clCreateKernel");
-	renderDepth_ocl_kernel = clCreateKernel(programs[1], "renderDepthKernel", &clError);
+	renderDepth_ocl_kernel = clCreateKernel(stageProgram(STAGE_RENDER), "renderDepthKernel", &clError);
 	checkErr(clError, "clCreateKernel");
-	renderTrack_ocl_kernel = clCreateKernel(programs[1], "renderTrackKernel", &clError);
+	renderTrack_ocl_kernel = clCreateKernel(stageProgram(STAGE_RENDER), "renderTrackKernel", &clError);
 	checkErr(clError, "clCreateKernel");
 
+	if (specialise_kernels)
+		buildSpecialisedKernels(computationSize, volumeResolution, volumeDimensions, step);
+
 }
 Kfusion::~Kfusion() {
 	if (reduceOutputBuffer) free(reduceOutputBuffer);
 	reduceOutputBuffer = NULL;
 
 	for (unsigned int i = 0; i < iterations.size(); ++i) {
-		if (ocl_ScaledDepth[i]) {
+		if (i > 0 && ocl_ScaledDepth[i]) {
 			clError = clReleaseMemObject(ocl_ScaledDepth[i]);
 			checkErr(clError, "clReleaseMem");
 			ocl_ScaledDepth[i] = NULL;
@@ -218,35 +672,26 @@ Kfusion::~Kfusion() {
 		ocl_inputNormal = NULL;
 	}
 
-	if (ocl_FloatDepth) {
-		clError = clReleaseMemObject(ocl_FloatDepth);
-		checkErr(clError, "clReleaseMem");
-		ocl_FloatDepth = NULL;
-	}
-	if (ocl_vertex) {
-		clError = clReleaseMemObject(ocl_vertex);
-		checkErr(clError, "clReleaseMem");
-		ocl_vertex = NULL;
-	}
-	if (ocl_normal) {
-	  	clError = clReleaseMemObject(ocl_normal);
-	  	checkErr(clError, "clReleaseMem");
-		ocl_normal = NULL;
-	}
-	if (ocl_trackingResult) {
-	 	clError = clReleaseMemObject(ocl_trackingResult);
-		checkErr(clError, "clReleaseMem");
-		ocl_trackingResult = NULL;
-	}
+	releaseStageBuffer(ocl_FloatDepth);
+	releaseStageBuffer(ocl_filteredDepth);
+	releaseStageBuffer(ocl_vertex);
+	releaseStageBuffer(ocl_normal);
+	releaseStageBuffer(ocl_trackingResult);
 	if (ocl_gaussian) {
 	 	clError = clReleaseMemObject(ocl_gaussian);
 		checkErr(clError, "clReleaseMem");
 		ocl_gaussian = NULL;
 	}
-	if (ocl_volume_data) {
-	 	clError = clReleaseMemObject(ocl_volume_data);
+	releaseStageBuffer(ocl_volume_data);
+	if (ocl_volume_weight) {
+		clError = clReleaseMemObject(ocl_volume_weight);
 		checkErr(clError, "clReleaseMem");
-		ocl_volume_data = NULL;
+		ocl_volume_weight = NULL;
+	}
+	if (host_volume.data) {
+		host_volume.release();
+		free(host_depth);
+		host_depth = NULL;
 	}
 	if (ocl_depth_buffer) {
 	 	clError = clReleaseMemObject(ocl_depth_buffer);
@@ -258,6 +703,12 @@ Kfusion::~Kfusion() {
 	    checkErr(clError, "clReleaseMem");
 		ocl_output_render_buffer = NULL;
 	}
+	unmapHostBuffer(ocl_depth_host, STAGE_PREPROCESS);
+	releaseHostBuffer(ocl_depth_host);
+	for (int i = 0; i < 3; ++i) {
+		unmapHostBuffer(ocl_render_host[i], STAGE_RENDER);
+		releaseHostBuffer(ocl_render_host[i]);
+	}
 	if (ocl_reduce_output_buffer) {
 		clError = clReleaseMemObject(ocl_reduce_output_buffer);
 		checkErr(clError, "clReleaseMem");
@@ -277,6 +728,21 @@ Kfusion::~Kfusion() {
 	RELEASE_KERNEL(renderTrack_ocl_kernel);
 	RELEASE_KERNEL(initVolume_ocl_kernel);
 
+	// cold start against cached binaries: init, program builds, builds, cached builds
+	*logstreamCustom << "opencl-init\t" << opencl_init_time << "\t" << opencl_build_time << "\t"
+			<< opencl_builds << "\t" << opencl_cached_builds << std::endl;
+	if (specialised_programs) {
+		reportSpecialisedKernels(*logstreamCustom);
+		for (int v = 0; v < VARIANT_COUNT; ++v) {
+			if (specialised[v].kernel) RELEASE_KERNEL(specialised[v].kernel);
+			specialised[v].kernel = NULL;
+		}
+		for (cl_uint p = 0; p < num_platforms; ++p)
+			if (specialised_programs[p]) clReleaseProgram(specialised_programs[p]);
+		free(specialised_programs);
+		specialised_programs = NULL;
+	}
+
 	mm2meters_ocl_kernel = NULL ;
 	bilateralFilter_ocl_kernel = NULL;
 	halfSampleRobustImage_ocl_kernel = NULL;
@@ -294,6 +760,13 @@ Kfusion::~Kfusion() {
 	computationSizeBkp = make_uint2(0, 0);
 	outputImageSizeBkp = make_uint2(0, 0);
 
+	if (transfer_queues) {
+		for (cl_uint d = 0; d < num_ocl_devices; ++d)
+			if (transfer_queues[d]) clReleaseCommandQueue(transfer_queues[d]);
+		free(transfer_queues);
+		transfer_queues = NULL;
+	}
+
 	clean();
 }
 
@@ -303,6 +776,7 @@ void Kfusion::reset() {
 }
 
 bool Kfusion::preprocessing(const uint16_t * inputDepth, const uint2 inSize) {
+	active_stage = STAGE_PREPROCESS;
 	startOfKernel = benchmark_tock();
 
 	uint2 outSize = computationSize;
@@ -323,28 +797,40 @@ bool Kfusion::preprocessing(const uint16_t * inputDepth, const uint2 inSize) {
 
 	int ratio = inSize.x / outSize.x;
 
-	if (computationSizeBkp.x < inSize.x|| computationSizeBkp.y < inSize.y || ocl_depth_buffer == NULL) {
-		computationSizeBkp = make_uint2(inSize.x, inSize.y);
-		if (ocl_depth_buffer != NULL) {
-			clError = clReleaseMemObject(ocl_depth_buffer);
-			checkErr(clError, "clReleaseMemObject");
+	cl_mem depthBuffer;
+	if (zero_copy) {
+		// The reader decoded straight into this memory, while it was mapped for writing since the last
+		// frame or before the buffer first wrapped it; unmapping publishes it to the device
+		depthBuffer = wrapHostBuffer(ocl_depth_host, (void *) inputDepth, inSize.x * inSize.y * sizeof(uint16_t), CL_MEM_READ_ONLY, STAGE_PREPROCESS);
+		unmapHostBuffer(ocl_depth_host, STAGE_PREPROCESS);
+	} else {
+		if (computationSizeBkp.x < inSize.x|| computationSizeBkp.y < inSize.y || ocl_depth_buffer == NULL) {
+			computationSizeBkp = make_uint2(inSize.x, inSize.y);
+			if (ocl_depth_buffer != NULL) {
+				clError = clReleaseMemObject(ocl_depth_buffer);
+				checkErr(clError, "clReleaseMemObject");
+			}
+			ocl_depth_buffer = clCreateBuffer(stageContext(STAGE_PREPROCESS), CL_MEM_READ_WRITE, inSize.x * inSize.y * sizeof(uint16_t), NULL, &clError);
+			checkErr(clError, "clCreateBuffer input");
 		}
-		ocl_depth_buffer = clCreateBuffer(contexts[1], CL_MEM_READ_WRITE, inSize.x * inSize.y * sizeof(uint16_t), NULL, &clError);
-		checkErr(clError, "clCreateBuffer input");
+		clError = clEnqueueWriteBuffer(stageQueue(STAGE_PREPROCESS), ocl_depth_buffer, CL_FALSE, 0, inSize.x * inSize.y * sizeof(uint16_t), inputDepth, 0, NULL, NULL);
+		checkErr(clError, "clEnqueueWriteBuffer");
+		depthBuffer = ocl_depth_buffer;
 	}
-	clError = clEnqueueWriteBuffer(cmd_queues[1][0], ocl_depth_buffer, CL_FALSE, 0, inSize.x * inSize.y * sizeof(uint16_t), inputDepth, 0, NULL, NULL);
-	checkErr(clError, "clEnqueueWriteBuffer");
+
+	cl_mem floatDepth = stageBuffer(ocl_FloatDepth, STAGE_PREPROCESS);
+	cl_mem filteredDepth = stageBuffer(ocl_filteredDepth, STAGE_PREPROCESS);
 
 	int arg = 0;
 	char errStr[20];
 
-	clError = clSetKernelArg(mm2meters_ocl_kernel, arg++, sizeof(cl_mem), &ocl_FloatDepth);
+	clError = clSetKernelArg(mm2meters_ocl_kernel, arg++, sizeof(cl_mem), &floatDepth);
 	sprintf(errStr, "clSetKernelArg%d", arg);
 	checkErr(clError, errStr);
 	clError = clSetKernelArg(mm2meters_ocl_kernel, arg++, sizeof(cl_uint2), &outSize);
 	sprintf(errStr, "clSetKernelArg%d", arg);
 	checkErr(clError, errStr);
-	clError = clSetKernelArg(mm2meters_ocl_kernel, arg++, sizeof(cl_mem), &ocl_depth_buffer);
+	clError = clSetKernelArg(mm2meters_ocl_kernel, arg++, sizeof(cl_mem), &depthBuffer);
 	sprintf(errStr, "clSetKernelArg%d", arg);
 	checkErr(clError, errStr);
 	clError = clSetKernelArg(mm2meters_ocl_kernel, arg++, sizeof(cl_uint2), &inSize);
@@ -356,8 +842,15 @@ bool Kfusion::preprocessing(const uint16_t * inputDepth, const uint2 inSize) {
 
 	size_t globalWorksize[2] = { outSize.x, outSize.y };
 
-	clError = clEnqueueNDRangeKernel(cmd_queues[1][0], mm2meters_ocl_kernel, 2, NULL, globalWorksize, NULL, 0, NULL, NULL);
+	clError = clEnqueueNDRangeKernel(stageQueue(STAGE_PREPROCESS), mm2meters_ocl_kernel, 2, NULL, globalWorksize, NULL, 0, NULL, NULL);
 	checkErr(clError, "clEnqueueNDRangeKernel");
+	publishBuffer(ocl_FloatDepth, STAGE_PREPROCESS);
+	if (zero_copy) {
+		// mapped for the reader to write the next frame into, once mm2meters has read this one;
+		// the map of a CL_MEM_USE_HOST_PTR buffer returns the caller's memory
+		ocl_depth_host.mapped = clEnqueueMapBuffer(stageQueue(STAGE_PREPROCESS), depthBuffer, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION, 0, inSize.x * inSize.y * sizeof(uint16_t), 0, NULL, NULL, &clError);
+		checkErr(clError, "clEnqueueMapBuffer");
+	}
 
 	endOfKernel = benchmark_tock();
 	timingsCPU[1] = endOfKernel - startOfKernel;
@@ -365,38 +858,47 @@ bool Kfusion::preprocessing(const uint16_t * inputDepth, const uint2 inSize) {
 	startOfKernel = endOfKernel;
 
 	arg = 0;
+	cl_kernel bilateral_kernel = useVariant(VARIANT_BILATERAL, bilateralFilter_ocl_kernel);
 
-	clError = clSetKernelArg(bilateralFilter_ocl_kernel, arg++, sizeof(cl_mem), &ocl_ScaledDepth[0]);
+	clError = clSetKernelArg(bilateral_kernel, arg++, sizeof(cl_mem), &filteredDepth);
 	sprintf(errStr, "clSetKernelArg%d", arg);
 	checkErr(clError, errStr);
-	clError = clSetKernelArg(bilateralFilter_ocl_kernel, arg++, sizeof(cl_mem), &ocl_FloatDepth);
+	clError = clSetKernelArg(bilateral_kernel, arg++, sizeof(cl_mem), &floatDepth);
 	sprintf(errStr, "clSetKernelArg%d", arg);
 	checkErr(clError, errStr);
-	clError = clSetKernelArg(bilateralFilter_ocl_kernel, arg++, sizeof(cl_mem), &ocl_gaussian);
+	clError = clSetKernelArg(bilateral_kernel, arg++, sizeof(cl_mem), &ocl_gaussian);
 	sprintf(errStr, "clSetKernelArg%d", arg);
 	checkErr(clError, errStr);
-	clError = clSetKernelArg(bilateralFilter_ocl_kernel, arg++, sizeof(cl_float), &e_delta);
+	clError = clSetKernelArg(bilateral_kernel, arg++, sizeof(cl_float), &e_delta);
 	sprintf(errStr, "clSetKernelArg%d", arg);
 	checkErr(clError, errStr);
-	clError = clSetKernelArg(bilateralFilter_ocl_kernel, arg++, sizeof(cl_int), &radius);
+	clError = clSetKernelArg(bilateral_kernel, arg++, sizeof(cl_int), &radius);
 	sprintf(errStr, "clSetKernelArg%d", arg);
 	checkErr(clError, errStr);
 
-	clError = clEnqueueNDRangeKernel(cmd_queues[1][0], bilateralFilter_ocl_kernel, 2, NULL, globalWorksize, NULL, 0, NULL, NULL);
+	clError = clEnqueueNDRangeKernel(stageQueue(STAGE_PREPROCESS), bilateral_kernel, 2, NULL, globalWorksize, NULL, 0, NULL, NULL);
 	checkErr(clError, "clEnqueueNDRangeKernel");
+	publishBuffer(ocl_filteredDepth, STAGE_PREPROCESS);
 
 	endOfKernel = benchmark_tock();
 	timingsCPU[2] = endOfKernel - startOfKernel;
+	timeVariant(VARIANT_BILATERAL, timingsCPU[2]);
 
 	return true;
 
 }
 bool Kfusion::tracking(float4 k, float icp_threshold, uint tracking_rate, uint frame) {
+	active_stage = STAGE_TRACK;
 	startOfKernel = benchmark_tock();
 
 	if ((frame % tracking_rate) != 0)
 		return false;
 
+	ocl_ScaledDepth[0] = acquireBuffer(ocl_filteredDepth, STAGE_TRACK);
+	cl_mem vertex = acquireBuffer(ocl_vertex, STAGE_TRACK);
+	cl_mem normal = acquireBuffer(ocl_normal, STAGE_TRACK);
+	cl_mem trackingResult = stageBuffer(ocl_trackingResult, STAGE_TRACK);
+
 	// half sample the input depth maps into the pyramid levels
 	for (unsigned int i = 1; i < iterations.size(); ++i) {
 		// outSize = computationSize / 2
@@ -429,7 +931,7 @@ bool Kfusion::tracking(float4 k, float icp_threshold, uint tracking_rate, uint f
 
 		size_t globalWorksize[2] = { outSize.x, outSize.y };
 
-		clError = clEnqueueNDRangeKernel(cmd_queues[1][0],
+		clError = clEnqueueNDRangeKernel(stageQueue(STAGE_TRACK),
 				halfSampleRobustImage_ocl_kernel, 2, NULL, globalWorksize, NULL,
 				0,
 				NULL, NULL);
@@ -471,7 +973,7 @@ bool Kfusion::tracking(float4 k, float icp_threshold, uint tracking_rate, uint f
 		checkErr(clError, errStr);
 		size_t globalWorksize[2] = { imageSize.x, imageSize.y };
 
-		clError = clEnqueueNDRangeKernel(cmd_queues[1][0], depth2vertex_ocl_kernel, 2, NULL, globalWorksize, NULL, 0, NULL, NULL);
+		clError = clEnqueueNDRangeKernel(stageQueue(STAGE_TRACK), depth2vertex_ocl_kernel, 2, NULL, globalWorksize, NULL, 0, NULL, NULL);
 		checkErr(clError, "clEnqueueNDRangeKernel");
 
 		endOfKernel = benchmark_tock();
@@ -495,7 +997,7 @@ bool Kfusion::tracking(float4 k, float icp_threshold, uint tracking_rate, uint f
 
 		size_t globalWorksize2[2] = { imageSize.x, imageSize.y };
 
-		clError = clEnqueueNDRangeKernel(cmd_queues[1][0], vertex2normal_ocl_kernel, 2, NULL, globalWorksize2, NULL, 0, NULL, NULL);
+		clError = clEnqueueNDRangeKernel(stageQueue(STAGE_TRACK), vertex2normal_ocl_kernel, 2, NULL, globalWorksize2, NULL, 0, NULL, NULL);
 		checkErr(clError, "clEnqueueNDRangeKernel");
 
 		localimagesize = make_uint2(localimagesize.x / 2, localimagesize.y / 2);
@@ -509,92 +1011,99 @@ bool Kfusion::tracking(float4 k, float icp_threshold, uint tracking_rate, uint f
 	startOfKernel = endOfKernel;
 
 	oldPose = pose;
+	if (motion_damping > 0)
+		pose = predictPose(motion_previous, oldPose, motion_damping);
+	motion_previous = oldPose;
 	const Matrix4 projectReference = getCameraMatrix(k) * inverse(raycastPose);
 	bool updatePoseKernelRes, checkPoseKernelRes;
 
+	icp_budget.begin();
 	for (int level = iterations.size() - 1; level >= 0; --level) {
 		uint2 localimagesize = make_uint2(computationSize.x / (int) pow(2, level), computationSize.y / (int) pow(2, level));
-		for (int i = 0; i < iterations[level]; ++i) {
+		for (int i = 0; i < icp_budget.budget[level]; ++i) {
 			int arg = 0;
 			char errStr[20];
+			cl_kernel track_kernel = useVariant(VARIANT_TRACK, track_ocl_kernel);
 
-			clError = clSetKernelArg(track_ocl_kernel, arg++, sizeof(cl_mem), &ocl_trackingResult);
+			clError = clSetKernelArg(track_kernel, arg++, sizeof(cl_mem), &trackingResult);
 			sprintf(errStr, "clSetKernelArg%d", arg);
 			checkErr(clError, errStr);
-			clError = clSetKernelArg(track_ocl_kernel, arg++, sizeof(cl_uint2), &computationSize);
+			clError = clSetKernelArg(track_kernel, arg++, sizeof(cl_uint2), &computationSize);
 			sprintf(errStr, "clSetKernelArg%d", arg);
 			checkErr(clError, errStr);
-			clError = clSetKernelArg(track_ocl_kernel, arg++, sizeof(cl_mem), &ocl_inputVertex[level]);
+			clError = clSetKernelArg(track_kernel, arg++, sizeof(cl_mem), &ocl_inputVertex[level]);
 			sprintf(errStr, "clSetKernelArg%d", arg);
 			checkErr(clError, errStr);
-			clError = clSetKernelArg(track_ocl_kernel, arg++, sizeof(cl_uint2), &localimagesize);
+			clError = clSetKernelArg(track_kernel, arg++, sizeof(cl_uint2), &localimagesize);
 			sprintf(errStr, "clSetKernelArg%d", arg);
 			checkErr(clError, errStr);
-			clError = clSetKernelArg(track_ocl_kernel, arg++, sizeof(cl_mem), &ocl_inputNormal[level]);
+			clError = clSetKernelArg(track_kernel, arg++, sizeof(cl_mem), &ocl_inputNormal[level]);
 			sprintf(errStr, "clSetKernelArg%d", arg);
 			checkErr(clError, errStr);
-			clError = clSetKernelArg(track_ocl_kernel, arg++, sizeof(cl_uint2), &localimagesize);
+			clError = clSetKernelArg(track_kernel, arg++, sizeof(cl_uint2), &localimagesize);
 			sprintf(errStr, "clSetKernelArg%d", arg);
 			checkErr(clError, errStr);
-			clError = clSetKernelArg(track_ocl_kernel, arg++, sizeof(cl_mem), &ocl_vertex);
+			clError = clSetKernelArg(track_kernel, arg++, sizeof(cl_mem), &vertex);
 			sprintf(errStr, "clSetKernelArg%d", arg);
 			checkErr(clError, errStr);
-			clError = clSetKernelArg(track_ocl_kernel, arg++, sizeof(cl_uint2), &computationSize);
+			clError = clSetKernelArg(track_kernel, arg++, sizeof(cl_uint2), &computationSize);
 			sprintf(errStr, "clSetKernelArg%d", arg);
 			checkErr(clError, errStr);
-			clError = clSetKernelArg(track_ocl_kernel, arg++, sizeof(cl_mem), &ocl_normal);
+			clError = clSetKernelArg(track_kernel, arg++, sizeof(cl_mem), &normal);
 			sprintf(errStr, "clSetKernelArg%d", arg);
 			checkErr(clError, errStr);
-			clError = clSetKernelArg(track_ocl_kernel, arg++, sizeof(cl_uint2), &computationSize);
+			clError = clSetKernelArg(track_kernel, arg++, sizeof(cl_uint2), &computationSize);
 			sprintf(errStr, "clSetKernelArg%d", arg);
 			checkErr(clError, errStr);
-			clError = clSetKernelArg(track_ocl_kernel, arg++, sizeof(Matrix4), &pose);
+			clError = clSetKernelArg(track_kernel, arg++, sizeof(Matrix4), &pose);
 			sprintf(errStr, "clSetKernelArg%d", arg);
 			checkErr(clError, errStr);
-			clError = clSetKernelArg(track_ocl_kernel, arg++, sizeof(Matrix4), &projectReference);
+			clError = clSetKernelArg(track_kernel, arg++, sizeof(Matrix4), &projectReference);
 			sprintf(errStr, "clSetKernelArg%d", arg);
 			checkErr(clError, errStr);
-			clError = clSetKernelArg(track_ocl_kernel, arg++, sizeof(cl_float), &dist_threshold);
+			clError = clSetKernelArg(track_kernel, arg++, sizeof(cl_float), &dist_threshold);
 			sprintf(errStr, "clSetKernelArg%d", arg);
 			checkErr(clError, errStr);
-			clError = clSetKernelArg(track_ocl_kernel, arg++, sizeof(cl_float), &normal_threshold);
+			clError = clSetKernelArg(track_kernel, arg++, sizeof(cl_float), &normal_threshold);
 			sprintf(errStr, "clSetKernelArg%d", arg);
 			checkErr(clError, errStr);
 
 			size_t globalWorksize[2] = { localimagesize.x, localimagesize.y };
 
-			clError = clEnqueueNDRangeKernel(cmd_queues[1][0], track_ocl_kernel, 2, NULL, globalWorksize, NULL, 0, NULL, NULL);
+			clError = clEnqueueNDRangeKernel(stageQueue(STAGE_TRACK), track_kernel, 2, NULL, globalWorksize, NULL, 0, NULL, NULL);
 			checkErr(clError, "clEnqueueNDRangeKernel");
 
 			endOfKernel = benchmark_tock();
 			timingsCPU[6] += endOfKernel - startOfKernel;
+			timeVariant(VARIANT_TRACK, endOfKernel - startOfKernel);
 
 			startOfKernel = endOfKernel;
 
 			arg = 0;
-			clError = clSetKernelArg(reduce_ocl_kernel, arg++, sizeof(cl_mem), &ocl_reduce_output_buffer);
+			cl_kernel reduce_kernel = useVariant(VARIANT_REDUCE, reduce_ocl_kernel);
+			clError = clSetKernelArg(reduce_kernel, arg++, sizeof(cl_mem), &ocl_reduce_output_buffer);
 			sprintf(errStr, "clSetKernelArg%d", arg);
 			checkErr(clError, errStr);
-			clError = clSetKernelArg(reduce_ocl_kernel, arg++, sizeof(cl_mem), &ocl_trackingResult);
+			clError = clSetKernelArg(reduce_kernel, arg++, sizeof(cl_mem), &trackingResult);
 			sprintf(errStr, "clSetKernelArg%d", arg);
 			checkErr(clError, errStr);
-			clError = clSetKernelArg(reduce_ocl_kernel, arg++, sizeof(cl_uint2), &computationSize);
+			clError = clSetKernelArg(reduce_kernel, arg++, sizeof(cl_uint2), &computationSize);
 			sprintf(errStr, "clSetKernelArg%d", arg);
 			checkErr(clError, errStr);
-			clError = clSetKernelArg(reduce_ocl_kernel, arg++, sizeof(cl_uint2), &localimagesize);
+			clError = clSetKernelArg(reduce_kernel, arg++, sizeof(cl_uint2), &localimagesize);
 			sprintf(errStr, "clSetKernelArg%d", arg);
 			checkErr(clError, errStr);
-			clError = clSetKernelArg(reduce_ocl_kernel, arg++, size_of_group * 32 * sizeof(float), NULL);
+			clError = clSetKernelArg(reduce_kernel, arg++, size_of_group * 32 * sizeof(float), NULL);
 			sprintf(errStr, "clSetKernelArg%d", arg);
 			checkErr(clError, errStr);
 
 			size_t RglobalWorksize[1] = { size_of_group * number_of_groups };
 			size_t RlocalWorksize[1] = { size_of_group }; // Dont change it !
 
-			clError = clEnqueueNDRangeKernel(cmd_queues[1][0], reduce_ocl_kernel, 1, NULL, RglobalWorksize, RlocalWorksize, 0, NULL, NULL);
+			clError = clEnqueueNDRangeKernel(stageQueue(STAGE_TRACK), reduce_kernel, 1, NULL, RglobalWorksize, RlocalWorksize, 0, NULL, NULL);
 			checkErr(clError, "clEnqueueNDRangeKernel");
 
-			clError = clEnqueueReadBuffer(cmd_queues[1][0], ocl_reduce_output_buffer, CL_TRUE, 0, 32 * number_of_groups * sizeof(float), reduceOutputBuffer, 0, NULL, NULL);
+			clError = clEnqueueReadBuffer(stageQueue(STAGE_TRACK), ocl_reduce_output_buffer, CL_TRUE, 0, 32 * number_of_groups * sizeof(float), reduceOutputBuffer, 0, NULL, NULL);
 			checkErr(clError, "clEnqueueReadBuffer");
 
 			TooN::Matrix<TooN::Dynamic, TooN::Dynamic, float, TooN::Reference::RowMajor> values(reduceOutputBuffer, number_of_groups, 32);
@@ -606,17 +1115,25 @@ bool Kfusion::tracking(float4 k, float icp_threshold, uint tracking_rate, uint f
 			updatePoseKernelRes = updatePoseKernel(pose, reduceOutputBuffer, icp_threshold);
 			endOfKernel = benchmark_tock();
 			timingsCPU[7] += endOfKernel - startOfKernel;
+			timeVariant(VARIANT_REDUCE, endOfKernel - startOfKernel);
 
 			startOfKernel = endOfKernel;
 
+			icp_budget.record(level, reduceOutputBuffer, updatePoseKernelRes);
 			if (updatePoseKernelRes) break;
 		}
 	}
 
+	publishBuffer(ocl_trackingResult, STAGE_TRACK);
 	checkPoseKernelRes = checkPoseKernel(pose, oldPose, reduceOutputBuffer, computationSize, track_threshold);
 	endOfKernel = benchmark_tock();
 	timingsCPU[6] += endOfKernel - startOfKernel;
 
+	if (motion_damping >= 0 || adaptive_icp)
+		icp_budget.print(*logstreamCustom, frame, checkPoseKernelRes);
+	if (adaptive_icp && checkPoseKernelRes)
+		icp_budget.adapt();
+
 	return checkPoseKernelRes;
 }
 
@@ -643,6 +1160,7 @@ bool checkPoseKernel(Matrix4 & pose, Matrix4 oldPose, const float * output, uint
 }
 
 bool Kfusion::integration(float4 k, uint integration_rate, float mu, uint frame) {
+	active_stage = STAGE_INTEGRATE;
 	startOfKernel = benchmark_tock();
 
 	bool doIntegrate = checkPoseKernel(pose, oldPose, reduceOutputBuffer, computationSize, track_threshold);
@@ -659,58 +1177,152 @@ bool Kfusion::integration(float4 k, uint integration_rate, float mu, uint frame)
 		const float3 delta = rotate(invTrack, make_float3(0, 0, volumeDimensions.z / volumeResolution.z));
 		const float3 cameraDelta = rotate(K, delta);
 
+		cl_mem volume = acquireBuffer(ocl_volume_data, STAGE_INTEGRATE);
+		cl_mem floatDepth = acquireBuffer(ocl_FloatDepth, STAGE_INTEGRATE);
+
 		int arg = 0;
 		char errStr[20];
+		cl_kernel integrate_kernel = useVariant(VARIANT_INTEGRATE, integrate_ocl_kernel, mu == specialised_mu);
 
-		clError = clSetKernelArg(integrate_ocl_kernel, arg++, sizeof(cl_mem), (void*) &ocl_volume_data);
+		clError = clSetKernelArg(integrate_kernel, arg++, sizeof(cl_mem), (void*) &volume);
 		sprintf(errStr, "clSetKernelArg%d", arg);
 		checkErr(clError, errStr);
-		clError = clSetKernelArg(integrate_ocl_kernel, arg++, sizeof(cl_uint3), (void*) &volumeResolution);
+		clError = clSetKernelArg(integrate_kernel, arg++, sizeof(cl_mem), (void*) &ocl_volume_weight);
 		sprintf(errStr, "clSetKernelArg%d", arg);
 		checkErr(clError, errStr);
-		clError = clSetKernelArg(integrate_ocl_kernel, arg++, sizeof(cl_float3), (void*) &volumeDimensions);
+		clError = clSetKernelArg(integrate_kernel, arg++, sizeof(cl_uint3), (void*) &volumeResolution);
 		sprintf(errStr, "clSetKernelArg%d", arg);
 		checkErr(clError, errStr);
-		clError = clSetKernelArg(integrate_ocl_kernel, arg++, sizeof(cl_mem), (void*) &ocl_FloatDepth);
+		clError = clSetKernelArg(integrate_kernel, arg++, sizeof(cl_float3), (void*) &volumeDimensions);
 		sprintf(errStr, "clSetKernelArg%d", arg);
 		checkErr(clError, errStr);
-		clError = clSetKernelArg(integrate_ocl_kernel, arg++, sizeof(cl_uint2), (void*) &depthSize);
+		clError = clSetKernelArg(integrate_kernel, arg++, sizeof(cl_mem), (void*) &floatDepth);
 		sprintf(errStr, "clSetKernelArg%d", arg);
 		checkErr(clError, errStr);
-		clError = clSetKernelArg(integrate_ocl_kernel, arg++, sizeof(Matrix4), (void*) &invTrack);
+		clError = clSetKernelArg(integrate_kernel, arg++, sizeof(cl_uint2), (void*) &depthSize);
 		sprintf(errStr, "clSetKernelArg%d", arg);
 		checkErr(clError, errStr);
-		clError = clSetKernelArg(integrate_ocl_kernel, arg++, sizeof(Matrix4), (void*) &K);
+		clError = clSetKernelArg(integrate_kernel, arg++, sizeof(Matrix4), (void*) &invTrack);
 		sprintf(errStr, "clSetKernelArg%d", arg);
 		checkErr(clError, errStr);
-		clError = clSetKernelArg(integrate_ocl_kernel, arg++, sizeof(cl_float), (void*) &mu);
+		clError = clSetKernelArg(integrate_kernel, arg++, sizeof(Matrix4), (void*) &K);
 		sprintf(errStr, "clSetKernelArg%d", arg);
 		checkErr(clError, errStr);
-		clError = clSetKernelArg(integrate_ocl_kernel, arg++, sizeof(cl_float), (void*) &maxweight);
+		clError = clSetKernelArg(integrate_kernel, arg++, sizeof(cl_float), (void*) &mu);
+		sprintf(errStr, "clSetKernelArg%d", arg);
+		checkErr(clError, errStr);
+		clError = clSetKernelArg(integrate_kernel, arg++, sizeof(cl_float), (void*) &maxweight);
 		sprintf(errStr, "clSetKernelArg%d", arg);
 		checkErr(clError, errStr);
 
-		clError = clSetKernelArg(integrate_ocl_kernel, arg++, sizeof(cl_float3), (void*) &delta);
+		clError = clSetKernelArg(integrate_kernel, arg++, sizeof(cl_float3), (void*) &delta);
 		sprintf(errStr, "clSetKernelArg%d", arg);
 		checkErr(clError, errStr);
-		clError = clSetKernelArg(integrate_ocl_kernel, arg++, sizeof(cl_float3), (void*) &cameraDelta);
+		clError = clSetKernelArg(integrate_kernel, arg++, sizeof(cl_float3), (void*) &cameraDelta);
 		sprintf(errStr, "clSetKernelArg%d", arg);
 		checkErr(clError, errStr);
 
-		size_t globalWorksize[2] = { volumeResolution.x, volumeResolution.y };
+		cl_command_queue queue = stageQueue(STAGE_INTEGRATE);
+		unsigned int deviceRows = volumeResolution.y;
+		if (integration_device_share < 1.0f)
+			deviceRows = (unsigned int) (integration_device_share * volumeResolution.y + 0.5f);
+		const size_t rowBytes = volumeResolution.x * sizeof(short);
+		const size_t sliceBytes = rowBytes * volumeResolution.y;
+
+		// Inputs of the host rows are read before the device rows are enqueued, so both sides run concurrently
+		cl_event hostInputs[3] = { NULL, NULL, NULL };
+		cl_uint numHostInputs = 0;
+		if (deviceRows < volumeResolution.y) {
+			if (host_volume.data == NULL) {
+				host_volume.init(volumeResolution, volumeDimensions);
+				host_depth = (float *) malloc(depthSize.x * depthSize.y * sizeof(float));
+				host_rows_begin = volumeResolution.y;
+			}
+			clError = clEnqueueReadBuffer(queue, floatDepth, CL_FALSE, 0, depthSize.x * depthSize.y * sizeof(float), host_depth, 0, NULL, &hostInputs[numHostInputs++]);
+			checkErr(clError, "clEnqueueReadBuffer");
+			// rows which moved to the host since the last frame are only current on the device
+			if (deviceRows < host_rows_begin) {
+				size_t origin[3] = { 0, deviceRows, 0 };
+				size_t region[3] = { rowBytes, host_rows_begin - deviceRows, volumeResolution.z };
+				clError = clEnqueueReadBufferRect(queue, volume, CL_FALSE, origin, origin, region, rowBytes, sliceBytes, rowBytes, sliceBytes, host_volume.data, 0, NULL, &hostInputs[numHostInputs++]);
+				checkErr(clError, "clEnqueueReadBufferRect");
+				clError = clEnqueueReadBufferRect(queue, ocl_volume_weight, CL_FALSE, origin, origin, region, rowBytes, sliceBytes, rowBytes, sliceBytes, host_volume.weight, 0, NULL, &hostInputs[numHostInputs++]);
+				checkErr(clError, "clEnqueueReadBufferRect");
+			}
+		}
+
+		double splitStart = host_clock();
+		cl_event deviceDone = NULL;
+		if (deviceRows > 0) {
+			size_t globalWorksize[2] = { volumeResolution.x, deviceRows };
+
+			clError = clEnqueueNDRangeKernel(queue, integrate_kernel, 2, NULL, globalWorksize, NULL, 0, NULL, (deviceRows < volumeResolution.y) ? &deviceDone : NULL);
+			checkErr(clError, "clEnqueueNDRangeKernel");
+		}
 
-		clError = clEnqueueNDRangeKernel(cmd_queues[1][0], integrate_ocl_kernel, 2, NULL, globalWorksize, NULL, 0, NULL, NULL);
+		if (deviceRows < volumeResolution.y) {
+			if (deviceDone) {
+				integrate_device_done = false;
+				clError = clSetEventCallback(deviceDone, CL_COMPLETE, integrateDeviceCallback, NULL);
+				checkErr(clError, "clSetEventCallback");
+			}
+			clError = clFlush(queue);
+			checkErr(clError, "clFlush");
+
+			clError = clWaitForEvents(numHostInputs, hostInputs);
+			checkErr(clError, "clWaitForEvents");
+			for (cl_uint i = 0; i < numHostInputs; ++i)
+				releaseEvent(hostInputs[i]);
+
+			integrateSlab(host_volume, host_depth, depthSize, invTrack, K, mu, maxweight, deviceRows, volumeResolution.y);
+			const double hostTime = host_clock() - splitStart;
+
+			size_t origin[3] = { 0, deviceRows, 0 };
+			size_t region[3] = { rowBytes, volumeResolution.y - deviceRows, volumeResolution.z };
+			clError = clEnqueueWriteBufferRect(queue, volume, CL_FALSE, origin, origin, region, rowBytes, sliceBytes, rowBytes, sliceBytes, host_volume.data, 0, NULL, NULL);
+			checkErr(clError, "clEnqueueWriteBufferRect");
+			clError = clEnqueueWriteBufferRect(queue, ocl_volume_weight, CL_FALSE, origin, origin, region, rowBytes, sliceBytes, rowBytes, sliceBytes, host_volume.weight, 0, NULL, NULL);
+			checkErr(clError, "clEnqueueWriteBufferRect");
+			host_rows_begin = deviceRows;
+
+			if (deviceDone) {
+				clError = clWaitForEvents(1, &deviceDone);
+				checkErr(clError, "clWaitForEvents");
+				double deviceEnd;
+				{
+					// the callback may lag behind the wait
+					std::unique_lock<std::mutex> guard(integrate_device_lock);
+					while (!integrate_device_done)
+						integrate_device_wake.wait(guard);
+					deviceEnd = integrate_device_end;
+				}
+				releaseEvent(deviceDone);
+				const double deviceTime = deviceEnd - splitStart;
+				const unsigned int hostRows = volumeResolution.y - deviceRows;
+
+				// balance the rows per second measured on each side, smoothed against jitter
+				const double deviceRate = deviceRows / fmax(deviceTime, 1e-6);
+				const double hostRate = hostRows / fmax(hostTime, 1e-6);
+				const float share = deviceRate / (deviceRate + hostRate);
+				integration_device_share = fminf(fmaxf(0.5f * (integration_device_share + share), 0.05f), 0.95f);
+
+				*logstreamCustom << "integration-split\t" << frame << "\t" << deviceRows << "\t" << deviceTime << "\t" << hostRows << "\t" << hostTime << std::endl;
+			}
+		}
+		publishBuffer(ocl_volume_data, STAGE_INTEGRATE);
 	} else {
 		doIntegrate = false;
 	}
 
 	endOfKernel = benchmark_tock();
 	timingsCPU[8] = endOfKernel - startOfKernel;
+	if (doIntegrate) timeVariant(VARIANT_INTEGRATE, timingsCPU[8]);
 
 	return doIntegrate;
 }
 
 bool Kfusion::raycasting(float4 k, float mu, uint frame) {
+	active_stage = STAGE_RAYCAST;
 	startOfKernel = benchmark_tock();
 
 	bool doRaycast = false;
@@ -721,147 +1333,126 @@ bool Kfusion::raycasting(float4 k, float mu, uint frame) {
 		raycastPose = pose;
 		const Matrix4 view = raycastPose * getInverseCameraMatrix(k);
 
+		cl_mem vertex = stageBuffer(ocl_vertex, STAGE_RAYCAST);
+		cl_mem normal = stageBuffer(ocl_normal, STAGE_RAYCAST);
+		cl_mem volume = acquireBuffer(ocl_volume_data, STAGE_RAYCAST);
+
 		int arg = 0;
 		char errStr[20];
+		cl_kernel raycast_kernel = useVariant(VARIANT_RAYCAST, raycast_ocl_kernel, mu == specialised_mu);
 
-		clError = clSetKernelArg(raycast_ocl_kernel, arg++, sizeof(cl_mem), (void*) &ocl_vertex);
+		clError = clSetKernelArg(raycast_kernel, arg++, sizeof(cl_mem), (void*) &vertex);
 		sprintf(errStr, "clSetKernelArg%d", arg);
 		checkErr(clError, errStr);
-		clError = clSetKernelArg(raycast_ocl_kernel, arg++, sizeof(cl_mem), (void*) &ocl_normal);
+		clError = clSetKernelArg(raycast_kernel, arg++, sizeof(cl_mem), (void*) &normal);
 		sprintf(errStr, "clSetKernelArg%d", arg);
 		checkErr(clError, errStr);
-		clError = clSetKernelArg(raycast_ocl_kernel, arg++, sizeof(cl_mem), (void*) &ocl_volume_data);
+		clError = clSetKernelArg(raycast_kernel, arg++, sizeof(cl_mem), (void*) &volume);
 		sprintf(errStr, "clSetKernelArg%d", arg);
 		checkErr(clError, errStr);
-		clError = clSetKernelArg(raycast_ocl_kernel, arg++, sizeof(cl_uint3), (void*) &volumeResolution);
+		clError = clSetKernelArg(raycast_kernel, arg++, sizeof(cl_uint3), (void*) &volumeResolution);
 		sprintf(errStr, "clSetKernelArg%d", arg);
 		checkErr(clError, errStr);
-		clError = clSetKernelArg(raycast_ocl_kernel, arg++, sizeof(cl_float3), (void*) &volumeDimensions);
+		clError = clSetKernelArg(raycast_kernel, arg++, sizeof(cl_float3), (void*) &volumeDimensions);
 		sprintf(errStr, "clSetKernelArg%d", arg);
 		checkErr(clError, errStr);
-		clError = clSetKernelArg(raycast_ocl_kernel, arg++, sizeof(Matrix4), (void*) &view);
+		clError = clSetKernelArg(raycast_kernel, arg++, sizeof(Matrix4), (void*) &view);
 		sprintf(errStr, "clSetKernelArg%d", arg);
 		checkErr(clError, errStr);
-		clError = clSetKernelArg(raycast_ocl_kernel, arg++, sizeof(cl_float), (void*) &nearPlane);
+		clError = clSetKernelArg(raycast_kernel, arg++, sizeof(cl_float), (void*) &nearPlane);
 		sprintf(errStr, "clSetKernelArg%d", arg);
 		checkErr(clError, errStr);
-		clError = clSetKernelArg(raycast_ocl_kernel, arg++, sizeof(cl_float), (void*) &farPlane);
+		clError = clSetKernelArg(raycast_kernel, arg++, sizeof(cl_float), (void*) &farPlane);
 		sprintf(errStr, "clSetKernelArg%d", arg);
 		checkErr(clError, errStr);
-		clError = clSetKernelArg(raycast_ocl_kernel, arg++, sizeof(cl_float), (void*) &step);
+		clError = clSetKernelArg(raycast_kernel, arg++, sizeof(cl_float), (void*) &step);
 		sprintf(errStr, "clSetKernelArg%d", arg);
 		checkErr(clError, errStr);
-		clError = clSetKernelArg(raycast_ocl_kernel, arg++, sizeof(cl_float), (void*) &largestep);
+		clError = clSetKernelArg(raycast_kernel, arg++, sizeof(cl_float), (void*) &largestep);
 		sprintf(errStr, "clSetKernelArg%d", arg);
 		checkErr(clError, errStr);
 
 		size_t RaycastglobalWorksize[2] = { computationSize.x, computationSize.y };
 
-		clError = clEnqueueNDRangeKernel(cmd_queues[1][0], raycast_ocl_kernel, 2, NULL, RaycastglobalWorksize, NULL, 0, NULL, NULL);
+		clError = clEnqueueNDRangeKernel(stageQueue(STAGE_RAYCAST), raycast_kernel, 2, NULL, RaycastglobalWorksize, NULL, 0, NULL, NULL);
 		checkErr(clError, "clEnqueueNDRangeKernel");
+		publishBuffer(ocl_vertex, STAGE_RAYCAST);
+		publishBuffer(ocl_normal, STAGE_RAYCAST);
 
 	}
 
 	endOfKernel = benchmark_tock();
 	timingsCPU[9] = endOfKernel - startOfKernel;
+	if (frame > 2) timeVariant(VARIANT_RAYCAST, timingsCPU[9]);
 
 	return doRaycast;
 }
 
 void Kfusion::renderDepth(uchar4 * out, uint2 outputSize) {
+	active_stage = STAGE_RENDER;
 	startOfKernel = benchmark_tock();
 
-    // Create render opencl buffer if needed
-    if(outputImageSizeBkp.x < outputSize.x || outputImageSizeBkp.y < outputSize.y || ocl_output_render_buffer == NULL) 
-    {
-		outputImageSizeBkp = make_uint2(outputSize.x, outputSize.y);
-		if(ocl_output_render_buffer != NULL){
-		    std::cout << "Release" << std::endl;
-		    clError = clReleaseMemObject(ocl_output_render_buffer);
-		    checkErr( clError, "clReleaseMemObject");
-		}
-		ocl_output_render_buffer = clCreateBuffer(contexts[1], CL_MEM_WRITE_ONLY, outputSize.x * outputSize.y * sizeof(uchar4), NULL , &clError);
-		checkErr(clError, "clCreateBuffer output" );
-    }
+	cl_mem outputBuffer = renderOutputBuffer(0, out, outputSize);
+	cl_mem floatDepth = acquireBuffer(ocl_FloatDepth, STAGE_RENDER);
 
-	clError = clSetKernelArg(renderDepth_ocl_kernel, 0, sizeof(cl_mem), &ocl_output_render_buffer);
-	clError &= clSetKernelArg(renderDepth_ocl_kernel, 1, sizeof(cl_mem), &ocl_FloatDepth);
+	clError = clSetKernelArg(renderDepth_ocl_kernel, 0, sizeof(cl_mem), &outputBuffer);
+	clError &= clSetKernelArg(renderDepth_ocl_kernel, 1, sizeof(cl_mem), &floatDepth);
 	clError &= clSetKernelArg(renderDepth_ocl_kernel, 2, sizeof(cl_float), &nearPlane);
 	clError &= clSetKernelArg(renderDepth_ocl_kernel, 3, sizeof(cl_float), &farPlane);
 	checkErr(clError, "clSetKernelArg");
 
 	size_t globalWorksize[2] = { computationSize.x, computationSize.y };
 
-	clError = clEnqueueNDRangeKernel(cmd_queues[1][0], renderDepth_ocl_kernel, 2,
+	clError = clEnqueueNDRangeKernel(stageQueue(STAGE_RENDER), renderDepth_ocl_kernel, 2,
 			NULL, globalWorksize, NULL, 0, NULL, NULL);
 	checkErr(clError, "clEnqueueNDRangeKernel");
 
-
-    clError = clEnqueueReadBuffer(cmd_queues[1][0], ocl_output_render_buffer, CL_FALSE, 0, outputSize.x * outputSize.y * sizeof(uchar4), out, 0, NULL, NULL );  
-    checkErr( clError, "clEnqueueReadBuffer");
+	readRenderOutput(0, outputBuffer, out, outputSize);
 
     endOfKernel = benchmark_tock();
 	timingsCPU[10] = endOfKernel - startOfKernel;
 }
 
 void Kfusion::renderTrack(uchar4 * out, uint2 outputSize) {
+	active_stage = STAGE_RENDER;
 	startOfKernel = benchmark_tock();
 
-    // Create render opencl buffer if needed
-    if(outputImageSizeBkp.x < outputSize.x || outputImageSizeBkp.y < outputSize.y || ocl_output_render_buffer == NULL) 
-    {
-		outputImageSizeBkp = make_uint2(outputSize.x, outputSize.y);
-		if(ocl_output_render_buffer != NULL){
-		    std::cout << "Release" << std::endl;
-		    clError = clReleaseMemObject(ocl_output_render_buffer);
-		    checkErr(clError, "clReleaseMemObject");
-		}
-		ocl_output_render_buffer = clCreateBuffer(contexts[1], CL_MEM_WRITE_ONLY, outputSize.x * outputSize.y * sizeof(uchar4), NULL , &clError);
-		checkErr(clError, "clCreateBuffer output" );
-    }
+	cl_mem outputBuffer = renderOutputBuffer(1, out, outputSize);
+	cl_mem trackingResult = acquireBuffer(ocl_trackingResult, STAGE_RENDER);
 
 	// set param and run kernel
-	clError = clSetKernelArg(renderTrack_ocl_kernel, 0, sizeof(cl_mem), &ocl_output_render_buffer);
-	clError &= clSetKernelArg(renderTrack_ocl_kernel, 1, sizeof(cl_mem), &ocl_trackingResult);
+	clError = clSetKernelArg(renderTrack_ocl_kernel, 0, sizeof(cl_mem), &outputBuffer);
+	clError &= clSetKernelArg(renderTrack_ocl_kernel, 1, sizeof(cl_mem), &trackingResult);
 	checkErr(clError, "clSetKernelArg");
 
 	size_t globalWorksize[2] = { computationSize.x, computationSize.y };
 
-	clError = clEnqueueNDRangeKernel(cmd_queues[1][0], renderTrack_ocl_kernel, 2, NULL, globalWorksize, NULL, 0, NULL, NULL);
+	clError = clEnqueueNDRangeKernel(stageQueue(STAGE_RENDER), renderTrack_ocl_kernel, 2, NULL, globalWorksize, NULL, 0, NULL, NULL);
 	checkErr(clError, "clEnqueueNDRangeKernel");
 
-    clError = clEnqueueReadBuffer(cmd_queues[1][0], ocl_output_render_buffer, CL_FALSE, 0, outputSize.x * outputSize.y * sizeof(uchar4), out, 0, NULL, NULL );  
-    checkErr(clError, "clEnqueueReadBuffer");
+	readRenderOutput(1, outputBuffer, out, outputSize);
 
     endOfKernel = benchmark_tock();
 	timingsCPU[11] = endOfKernel - startOfKernel;
 }
 
 void Kfusion::renderVolume(uchar4 * out, uint2 outputSize, int frame, int rate, float4 k, float largestep) {
+	active_stage = STAGE_RENDER;
 	startOfKernel = benchmark_tock();
 
     if (frame % rate != 0) return;
-    // Create render opencl buffer if needed
-    if(outputImageSizeBkp.x < outputSize.x || outputImageSizeBkp.y < outputSize.y || ocl_output_render_buffer == NULL) {
-		outputImageSizeBkp = make_uint2(outputSize.x, outputSize.y);
-		if(ocl_output_render_buffer != NULL) {
-		    std::cout << "Release" << std::endl;
-		    clError = clReleaseMemObject(ocl_output_render_buffer);
-		    checkErr(clError, "clReleaseMemObject");
-		}
-		ocl_output_render_buffer = clCreateBuffer(contexts[1],  CL_MEM_WRITE_ONLY, outputSize.x * outputSize.y * sizeof(uchar4), NULL , &clError);
-		checkErr(clError, "clCreateBuffer output" );
-    }
+	cl_mem outputBuffer = renderOutputBuffer(2, out, outputSize);
+	cl_mem volume = acquireBuffer(ocl_volume_data, STAGE_RENDER);
 
 	Matrix4 view = *viewPose * getInverseCameraMatrix(k);
 
 	int arg = 0;
 	char errStr[20];
 
-    clError = clSetKernelArg(renderVolume_ocl_kernel, arg++, sizeof(cl_mem), (void*) &ocl_output_render_buffer);
+    clError = clSetKernelArg(renderVolume_ocl_kernel, arg++, sizeof(cl_mem), (void*) &outputBuffer);
 	sprintf(errStr, "clSetKernelArg%d", arg);
 	checkErr(clError, errStr);
-	clError = clSetKernelArg(renderVolume_ocl_kernel, arg++, sizeof(cl_mem), (void*) &ocl_volume_data);
+	clError = clSetKernelArg(renderVolume_ocl_kernel, arg++, sizeof(cl_mem), (void*) &volume);
 	sprintf(errStr, "clSetKernelArg%d", arg);
 	checkErr(clError, errStr);
 	clError = clSetKernelArg(renderVolume_ocl_kernel, arg++, sizeof(cl_uint3), (void*) &volumeResolution);
@@ -894,11 +1485,10 @@ void Kfusion::renderVolume(uchar4 * out, uint2 outputSize, int frame, int rate,
 
 	size_t globalWorksize[2] = { computationSize.x, computationSize.y };
 
-	clError = clEnqueueNDRangeKernel(cmd_queues[1][0], renderVolume_ocl_kernel, 2, NULL, globalWorksize, NULL, 0, NULL, NULL);
+	clError = clEnqueueNDRangeKernel(stageQueue(STAGE_RENDER), renderVolume_ocl_kernel, 2, NULL, globalWorksize, NULL, 0, NULL, NULL);
 	checkErr(clError, "clEnqueueNDRangeKernel");
 
-    clError = clEnqueueReadBuffer(cmd_queues[1][0], ocl_output_render_buffer, CL_FALSE, 0, outputSize.x * outputSize.y * sizeof(uchar4), out, 0, NULL, NULL );  
-    checkErr(clError, "clEnqueueReadBuffer");
+	readRenderOutput(2, outputBuffer, out, outputSize);
 
     endOfKernel = benchmark_tock();
 	timingsCPU[12] = endOfKernel - startOfKernel;
@@ -917,28 +1507,103 @@ void Kfusion::dumpVolume(const char* filename) {
 		std::cout << "Error opening file: " << filename << std::endl;
 		exit(1);
 	}
-	short2 * volume_data = (short2*) malloc(
+	short * volume_data = (short*) malloc(
 			volumeResolution.x * volumeResolution.y * volumeResolution.z
-					* sizeof(short2));
-	clEnqueueReadBuffer(cmd_queues[1][0], ocl_volume_data, CL_TRUE, 0,
+					* sizeof(short));
+	clEnqueueReadBuffer(stageQueue(STAGE_INTEGRATE), stageBuffer(ocl_volume_data, STAGE_INTEGRATE), CL_TRUE, 0,
 			volumeResolution.x * volumeResolution.y * volumeResolution.z
-					* sizeof(short2), volume_data, 0, NULL, NULL);
+					* sizeof(short), volume_data, 0, NULL, NULL);
 
 	std::cout << "Dumping the volumetric representation on file: " << filename
 			<< std::endl;
 
-	// Dump on file without the y component of the short2 variable
-	for (unsigned int i = 0;
-			i < volumeResolution.x * volumeResolution.y * volumeResolution.z;
-			i++) {
-		fDumpFile.write((char *) (volume_data + i), sizeof(short));
-	}
+	// Dump on file the TSDF array only, weights are not part of the format
+	fDumpFile.write((char *) volume_data,
+			volumeResolution.x * volumeResolution.y * volumeResolution.z
+					* sizeof(short));
 
 	fDumpFile.close();
 	free(volume_data);
 
 }
 
+void Kfusion::dumpMesh(const char* filename) {
+
+	if (filename == NULL) {
+		return;
+	}
+
+	// Mesh a host copy of both arrays with the CPU extraction
+	VolumeT<VoxelShort> mesh_volume;
+	mesh_volume.init(volumeResolution, volumeDimensions);
+	const size_t bytes = volumeResolution.x * volumeResolution.y * volumeResolution.z * sizeof(short);
+	clError = clEnqueueReadBuffer(stageQueue(STAGE_INTEGRATE), stageBuffer(ocl_volume_data, STAGE_INTEGRATE), CL_FALSE, 0, bytes, mesh_volume.data, 0, NULL, NULL);
+	checkErr(clError, "clEnqueueReadBuffer");
+	clError = clEnqueueReadBuffer(stageQueue(STAGE_INTEGRATE), ocl_volume_weight, CL_TRUE, 0, bytes, mesh_volume.weight, 0, NULL, NULL);
+	checkErr(clError, "clEnqueueReadBuffer");
+
+	std::vector<float3> vertices;
+	std::vector<uint3> triangles;
+	const double start = host_clock();
+	marchingCubes(mesh_volume, vertices, triangles);
+	const double end = host_clock();
+	mesh_volume.release();
+
+	std::cout << "Dumping a mesh of " << vertices.size() << " vertices and "
+			<< triangles.size() << " triangles on file: " << filename
+			<< " (extracted in " << end - start << " s)" << std::endl;
+	writePLY(filename, vertices, triangles);
+
+}
+
+void Kfusion::saveCheckpoint(const char* filename, uint frame) {
+
+	if (filename == NULL) {
+		return;
+	}
+
+	VolumeT<VoxelShort> checkpoint_volume;
+	checkpoint_volume.init(volumeResolution, volumeDimensions);
+	const size_t bytes = volumeResolution.x * volumeResolution.y * volumeResolution.z * sizeof(short);
+	clError = clEnqueueReadBuffer(stageQueue(STAGE_INTEGRATE), stageBuffer(ocl_volume_data, STAGE_INTEGRATE), CL_FALSE, 0, bytes, checkpoint_volume.data, 0, NULL, NULL);
+	checkErr(clError, "clEnqueueReadBuffer");
+	clError = clEnqueueReadBuffer(stageQueue(STAGE_INTEGRATE), ocl_volume_weight, CL_TRUE, 0, bytes, checkpoint_volume.weight, 0, NULL, NULL);
+	checkErr(clError, "clEnqueueReadBuffer");
+	writeCheckpoint(filename, checkpoint_volume, pose, frame);
+	checkpoint_volume.release();
+
+}
+
+uint Kfusion::loadCheckpoint(const char* filename) {
+
+	VolumeT<VoxelShort> checkpoint_volume;
+	checkpoint_volume.init(volumeResolution, volumeDimensions);
+	const uint frame = readCheckpoint(filename, checkpoint_volume, pose);
+	const size_t bytes = volumeResolution.x * volumeResolution.y * volumeResolution.z * sizeof(short);
+	clError = clEnqueueWriteBuffer(stageQueue(STAGE_INTEGRATE), stageBuffer(ocl_volume_data, STAGE_INTEGRATE), CL_FALSE, 0, bytes, checkpoint_volume.data, 0, NULL, NULL);
+	checkErr(clError, "clEnqueueWriteBuffer");
+	clError = clEnqueueWriteBuffer(stageQueue(STAGE_INTEGRATE), ocl_volume_weight, CL_TRUE, 0, bytes, checkpoint_volume.weight, 0, NULL, NULL);
+	checkErr(clError, "clEnqueueWriteBuffer");
+	publishBuffer(ocl_volume_data, STAGE_INTEGRATE);
+	checkpoint_volume.release();
+
+	// the host rows of a split integration are read again from the device
+	host_rows_begin = volumeResolution.y;
+	oldPose = pose;
+	raycastPose = pose;
+	motion_previous = pose;
+	return frame;
+
+}
+
+uint Kfusion::meshDelta(uint since, std::vector<uint> & bricks,
+		std::vector<BrickMesh> & meshes, bool) {
+	// no live mesh in the OpenCL implementation
+	bricks.clear();
+	meshes.clear();
+	return since;
+}
+
 void Kfusion::computeFrame(const ushort * inputDepth, const uint2 inputSize, float4 k, uint integration_rate, uint tracking_rate, float icp_threshold, float mu, const uint frame) {
 	preprocessing(inputDepth, inputSize);
 	_tracked = tracking(k, icp_threshold, tracking_rate, frame);
@@ -946,6 +1611,59 @@ void Kfusion::computeFrame(const ushort * inputDepth, const uint2 inputSize, flo
 	raycasting(k, mu, frame);
 }
 
+// Wait for the queue of the running stage only, migrations and other devices keep going
+void synchroniseStage() {
+	clFinish(stageQueue(active_stage));
+}
+
 void synchroniseDevices() {
-	clFinish(cmd_queues[1][0]);
+	for (int s = 0; s < STAGE_COUNT; ++s)
+		clFinish(stageQueue((PipelineStage) s));
+	if (transfer_queues) {
+		for (cl_uint d = 0; d < num_ocl_devices; ++d)
+			if (transfer_queues[d]) clFinish(transfer_queues[d]);
+	}
+}
+
+void setRollingVolume(float threshold, const std::string &) {
+	if (threshold > 0)
+		std::cerr << "Rolling volume is ignored by the OpenCL implementation" << std::endl;
+}
+
+void setLiveMesh(bool enable) {
+	if (enable)
+		std::cerr << "Live mesh is ignored by the OpenCL implementation" << std::endl;
+}
+
+void setVolumeFile(const std::string & filename) {
+	if (filename != "")
+		std::cerr << "File-backed volume is ignored by the OpenCL implementation" << std::endl;
+}
+
+void setBandIntegration(bool enable) {
+	if (enable)
+		std::cerr << "Band integration is ignored by the OpenCL implementation" << std::endl;
+}
+
+void setMotionModel(float damping) {
+	motion_damping = damping;
+}
+
+void setAdaptiveIcp(bool enable) {
+	adaptive_icp = enable;
+}
+
+void setRaycastRatio(uint ratio) {
+	if (ratio != 1)
+		std::cerr << "Raycast ratio is ignored by the OpenCL implementation" << std::endl;
+}
+
+void setReferencePyramid(bool enable) {
+	if (enable)
+		std::cerr << "Reference pyramid is ignored by the OpenCL implementation" << std::endl;
+}
+
+void setIcpSampling(const std::string & policy, uint samples) {
+	if (policy != "all")
+		std::cerr << "ICP sampling is ignored by the OpenCL implementation" << std::endl;
 }